@@ -0,0 +1,42 @@
+#ifndef _CRC32C_
+#define _CRC32C_
+#include<nmmintrin.h>
+// CRC32C (Castagnoli) using the SSE4.2 crc32 instruction
+
+// Extend an in-progress crc, start from crc32c_init and finish with
+// crc32c_final
+static const unsigned int crc32c_init = 0xffffffff;
+
+static unsigned int crc32c_extend(unsigned int crc, 
+				  const void *buf, 
+				  unsigned long len)
+{
+  const unsigned char *p = (const unsigned char *)buf;
+  unsigned long c = crc;
+  while(len && ((unsigned long)p & 7)) {
+    c = _mm_crc32_u8((unsigned int)c, *p++);
+    len--;
+  }
+  while(len >= 8) {
+    c = _mm_crc32_u64(c, *(const unsigned long *)p);
+    p   += 8;
+    len -= 8;
+  }
+  while(len) {
+    c = _mm_crc32_u8((unsigned int)c, *p++);
+    len--;
+  }
+  return (unsigned int)c;
+}
+
+static unsigned int crc32c_final(unsigned int crc)
+{
+  return ~crc;
+}
+
+static unsigned int crc32c(const void *buf, unsigned long len)
+{
+  return crc32c_final(crc32c_extend(crc32c_init, buf, len));
+}
+
+#endif
@@ -12,6 +12,7 @@ extern dpdk_context_t * global_dpdk_context;
 extern cyclone_t ** quorums;
 struct rte_ring ** to_cores;
 struct rte_ring ** to_quorums;
+struct rte_ring ** to_anycore = NULL; // Per quorum, see dispatcher_ro_anycore
 struct rte_ring *from_cores;
 extern core_status_t *core_status;
 
@@ -374,10 +375,9 @@ static int __raft_logentry_offer_batch(raft_server_t* raft,
 	handle_cfg_change(cyclone_handle, e, (unsigned char *)rpc);
 	// Issue unless nodeadd final step
 	if(e->type != RAFT_LOGTYPE_ADD_NODE) { 
-	  unsigned long core_mask = rpc->core_mask;
-	  while(core_mask != 0) {
-	    int core  = __builtin_ffsl(core_mask) - 1;
-	    core_mask = core_mask & ~(1UL << core);
+	  core_mask_t core_mask = rpc->core_mask;
+	  int core_leader = core_mask_first(core_mask);
+	  for_each_core(core, core_mask) {
 	    if(core_to_quorum(core) != cyclone_handle->me_quorum) {
 	      continue;
 	    }
@@ -387,14 +387,13 @@ static int __raft_logentry_offer_batch(raft_server_t* raft,
 	    if(!is_multicore_rpc(rpc)) {
 	      cyclone_handle->add_inflight(rpc->client_id);
 	    }
-	    else if(core == (__builtin_ffsl(rpc->core_mask) - 1)) {
+	    else if(core == core_leader) {
 	      quorums[0]->add_inflight(rpc->client_id);
 	    }
-	    void *triple[3];
-	    triple[0] = (void *)(unsigned long)cyclone_handle->me_quorum;
-	    triple[1] = saved_head;
-	    triple[2] = rpc;
-	    if(rte_ring_mp_enqueue_bulk(to_cores[core], triple, 3) == -ENOBUFS) {
+	    void *desc = exec_desc_encode(cyclone_handle->me_quorum,
+					  saved_head,
+					  rpc);
+	    if(rte_ring_mp_enqueue(to_cores[core], desc) == -ENOBUFS) {
 	      BOOST_LOG_TRIVIAL(fatal) << "raft->core comm ring is full (req rw)";
 	      exit(-1);
 	    }
@@ -626,7 +625,19 @@ void* cyclone_setup(const char *config_quorum_path,
   cyclone_handle->ae_response_cnt = 0;
   cyclone_handle->raft_handle = raft_new();
   cyclone_handle->match_indices = (int *)malloc(cyclone_handle->replicas*sizeof(int));
-  cyclone_handle->client_inflight = (char *)malloc(MAX_CLIENTS*sizeof(char));
+  if(clients < 1 || clients > (int)MAX_CLIENTS) {
+    BOOST_LOG_TRIVIAL(fatal) << "clients must be in 1.." << MAX_CLIENTS;
+    exit(-1);
+  }
+  cyclone_handle->max_clients = clients;
+  cyclone_handle->client_credits = 
+    (client_credit_t *)malloc((clients + 1)*sizeof(client_credit_t));
+  for(int i=0;i<=clients;i++) {
+    cyclone_handle->client_credits[i].inflight = 0;
+    cyclone_handle->client_credits[i].window   = credit_window_default;
+  }
+  cyclone_handle->dedup =
+    (dedup_entry_t *)calloc(dedup_slots, sizeof(dedup_entry_t));
 
   for(int i=0;i<cyclone_handle->replicas;i++) {
     cyclone_handle->match_indices[i] = -1;
@@ -727,7 +738,7 @@ void cyclone_boot()
   for(int i=0;i<num_quorums;i++) {
     int e = rte_eal_remote_launch(dpdk_raft_monitor, 
 				  (void *)quorums[i]->monitor_obj, 
-				  1 + i);
+				  lcore_layout.raft[i]);
     if(e != 0) {
       BOOST_LOG_TRIVIAL(fatal) << "Failed to launch raft monitor on remote lcore";
       exit(-1);
@@ -4,6 +4,7 @@ extern "C" {
  #include<raft.h>
 }
 #include "libcyclone.hpp"
+#include "spin_wait.hpp"
 #include <stdlib.h>
 #include <string.h>
 //#include "logging.hpp"
@@ -35,11 +36,71 @@ extern void cyclone_boot();
 
 extern void cyclone_shutdown(void *cyclone_handle);
 
+//////// Lcore placement (lcore_layout.cpp)
+typedef struct lcore_layout_st {
+  int raft[MAX_QUORUMS];
+  int executor[MAX_EXECUTOR_THREADS];
+  int logger; // -1 without an offload flash logger
+  int quorum_socket[MAX_QUORUMS]; // Of the quorum's NIC port
+} lcore_layout_t;
+extern lcore_layout_t lcore_layout;
+
+// Follows dispatch.lcores (raft monitors, executors then the logger) if
+// given, else puts each quorum's monitor and executors on the socket of
+// its NIC port. Needs the network initialized.
+void lcore_layout_init(const char *config_quorum_path, int logger);
+
 //////// Cfg changes
 typedef struct cfg_change_st {
   int node; // Node to be added/deleted
 } cfg_change_t;
 
+// Split a RPC_FLAG_BATCH payload into its ops, returns their count or
+// -1 if malformed
+static int batch_split(const unsigned char *payload,
+		       int len,
+		       const unsigned char **data,
+		       int *lens)
+{
+  if(len < (int)sizeof(int)) {
+    return -1;
+  }
+  int ops = *(const int *)payload;
+  if(ops < 0 || ops > batch_max_ops) {
+    return -1;
+  }
+  payload += sizeof(int);
+  len     -= sizeof(int);
+  for(int i=0;i<ops;i++) {
+    if(len < (int)sizeof(batch_op_t)) {
+      return -1;
+    }
+    int size = ((const batch_op_t *)payload)->size;
+    payload += sizeof(batch_op_t);
+    len     -= sizeof(batch_op_t);
+    if(size < 0 || size > len) {
+      return -1;
+    }
+    data[i]  = payload;
+    lens[i]  = size;
+    payload += size;
+    len     -= size;
+  }
+  return ops;
+}
+
+// RPC_REP_REDIRECT payload: the leader as known to a follower
+typedef struct leader_hint_st {
+  int leader; // Replica, -1 during an election
+  unsigned int term;
+} leader_hint_t;
+
+// Partition move, multicore request on the old and new core
+typedef struct remap_st {
+  int partition;
+  int core; // New owner
+} remap_t;
+
 // Comm between app core and raft core
 typedef struct wal_entry_st {
   volatile int rep;
@@ -53,11 +114,12 @@ typedef struct rpc_st {
   int code;
   int flags;
   int payload_sz;
-  unsigned long core_mask;
+  core_mask_t core_mask;
   int client_id;
   int requestor;
   int client_port;
   int quorum_term;
+  int partition; // RPC_REQ routed by partition map, else -1
   unsigned long channel_seq;
   unsigned long timestamp; // For tracing
 } __attribute__((packed)) rpc_t; // Used for both requests and replies
@@ -76,130 +138,226 @@ static ic_rdv_t *rpc2rdv(rpc_t *rpc)
   return (ic_rdv_t *)ptr;
 }
 
+// Rendezvous slot on its own cache line, tagged with the request nonce
+// so it never needs resetting
+typedef struct barrier_slot_st {
+  volatile unsigned long tag;
+  volatile int ok;
+} __attribute__((aligned(64))) barrier_slot_t;
+
 typedef struct core_status_st {
   volatile int exec_term;
   volatile int checkpoint_idx;
-  volatile int stable;
-  ic_rdv_t nonce;
-  volatile int success;
-  volatile unsigned long barrier[2];
+  barrier_slot_t arrive;  // Written by this core
+  barrier_slot_t release; // Written by the core that waited for it
 } __attribute__((aligned(64))) core_status_t;
 
 extern core_status_t *core_status;
 
-static int is_multicore_rpc(rpc_t *rpc)
+// The servers' live partition_map is a seqlock: a remap makes
+// partition_map_seq odd while it writes (remaps of disjoint core pairs
+// may run at once), readers retry if it moved under them. The number of
+// partitions never changes.
+extern volatile unsigned long partition_map_seq;
+
+static unsigned long partition_map_read_begin()
 {
-  if(rpc->core_mask & (rpc->core_mask - 1)) {
-    return 1;
-  }
-  else {
-    return 0;
+  spin_wait_t w;
+  spin_wait_init(&w);
+  unsigned long seq;
+  while((seq = partition_map_seq) & 1) {
+    spin_wait_step(&w, (volatile int *)&partition_map_seq, (int)seq);
   }
+  __sync_synchronize();
+  return seq;
+}
+
+static int partition_map_read_retry(unsigned long seq)
+{
+  __sync_synchronize();
+  return partition_map_seq != seq;
+}
+
+// Core owning a partition in range
+static int partition_map_owner(int partition)
+{
+  unsigned long seq;
+  int owner;
+  do {
+    seq   = partition_map_read_begin();
+    owner = partition_map.core[partition];
+  } while(partition_map_read_retry(seq));
+  return owner;
+}
+
+// Consistent copy of the map as sent to clients, partition_map_size
+// bytes
+static void partition_map_copy(void *to)
+{
+  unsigned long seq;
+  do {
+    seq = partition_map_read_begin();
+    memcpy(to, &partition_map, partition_map_size(&partition_map));
+  } while(partition_map_read_retry(seq));
 }
 
-static unsigned long check_terms(unsigned int *snapshot)
+static void partition_map_write_lock()
 {
-  unsigned long failed = 0;
-  for(int i=0;i<executor_threads;i++) {
-    if(snapshot[core_to_quorum(i)] < core_status[i].exec_term) {
-      failed = failed | (1UL << i);
+  spin_wait_t w;
+  spin_wait_init(&w);
+  while(true) {
+    unsigned long seq = partition_map_seq;
+    if(!(seq & 1) &&
+       __sync_bool_compare_and_swap(&partition_map_seq, seq, seq + 1)) {
+      return;
     }
+    spin_wait_step(&w, (volatile int *)&partition_map_seq, (int)seq);
   }
-  return failed;
 }
 
+static void partition_map_write_unlock()
+{
+  __sync_fetch_and_add(&partition_map_seq, 1);
+}
 
-static int wait_barrier_follower(core_status_t *c_leader, 
-				 ic_rdv_t *nonce,
-				 int core_id,
-				 unsigned int term_leader,
-				 unsigned long mask)
+// One wait step on a slot whose tag has not reached ours yet, bounded
+// so the caller gets back to its term checks
+static void barrier_wait_step(spin_wait_t *w, barrier_slot_t *slot)
 {
-  ic_rdv_t *n = NULL;
-  int stable;
-  int success;
-  while(true) {
-    if(c_leader->exec_term > term_leader) {
-      /*
-      BOOST_LOG_TRIVIAL(info) << "leader term wrong "
-			      << c_leader->exec_term
-			      << " != "
-			      << term_leader;
-      */
+  unsigned long seen = slot->tag;
+  // Low word changes with every nonce
+  spin_wait_step(w, (volatile int *)&slot->tag, (int)seen);
+}
+
+static int is_multicore_rpc(rpc_t *rpc)
+{
+  return core_mask_is_multi(rpc->core_mask);
+}
+
+// Multicore rendezvous: the participating cores, in core order, form a
+// barrier_fanout-ary tree rooted at the lowest core. Each core waits for
+// its children to arrive, arrives itself and waits for its parent to
+// release it. A core whose quorum has moved past the snapshot term never
+// arrives, whoever waits for it polls only that core's term and adopts
+// its children instead.
+typedef struct rdv_tree_st {
+  int cores[MAX_EXECUTOR_THREADS];
+  int count;
+  unsigned long tag;
+  unsigned int *snapshot;
+} rdv_tree_t;
+
+// The core's quorum moved past the term snapshotted for the request, it
+// never reaches it
+static int core_term_failed(unsigned int *snapshot, int core)
+{
+  return snapshot[core_to_quorum(core)] < core_status[core].exec_term;
+}
+
+static int rdv_failed(rdv_tree_t *t, int core)
+{
+  return core_term_failed(t->snapshot, core);
+}
+
+// Wait for the subtree at rank r, collecting arrived cores to release.
+// Returns 0 if the root failed and the rendezvous is off.
+static int rdv_gather(rdv_tree_t *t,
+		      int r,
+		      int *ok,
+		      int *wake,
+		      int *wakes)
+{
+  int core = t->cores[r];
+  core_status_t *c = &core_status[core];
+  spin_wait_t w;
+  spin_wait_init(&w);
+  while(c->arrive.tag != t->tag) {
+    if(rdv_failed(t, core)) {
+      *ok = 0;
+      for(int i=1;i<=barrier_fanout;i++) {
+	int child = r*barrier_fanout + i;
+	if(child >= t->count) {
+	  break;
+	}
+	if(!rdv_gather(t, child, ok, wake, wakes)) {
+	  return 0;
+	}
+      }
+      return 1;
+    }
+    if(r != 0 && rdv_failed(t, t->cores[0])) {
       return 0;
     }
-    stable = c_leader->stable;
-    if(stable & 1)
-      continue;
-    if(memcmp(&c_leader->nonce, nonce, sizeof(ic_rdv_t)) != 0)
-      continue;
-    if(stable != c_leader->stable)
-      continue;
-    break;
+    barrier_wait_step(&w, &c->arrive);
   }
-  __sync_fetch_and_or(&c_leader->barrier[0], 1UL << core_id);
-  while(c_leader->barrier[0] != mask);
-  success = c_leader->success;
-  __sync_fetch_and_or(&c_leader->barrier[1], 1UL << core_id);
-  /*
-  if(!success) {
-    BOOST_LOG_TRIVIAL(info) << "leader indicated fail ";
+  __sync_synchronize();
+  if(!c->arrive.ok) {
+    *ok = 0;
   }
-  */
-  return success;
+  wake[(*wakes)++] = core;
+  return 1;
 }
 
-
-static int wait_barrier_leader(core_status_t *c_leader,
-			       ic_rdv_t *nonce,
-			       int core_id,
-			       unsigned int *snapshot,
-			       unsigned long mask)
+// Returns 1 if every participant reached the rendezvous
+static int wait_barrier(ic_rdv_t *nonce,
+			int core_id,
+			unsigned int *snapshot,
+			core_mask_t mask)
 {
-  ic_rdv_t *n = NULL;
-  int stable;
-  c_leader->stable++;
-  __sync_synchronize();
-  memcpy(&c_leader->nonce, nonce, sizeof(ic_rdv_t));
-  __sync_synchronize();
-  c_leader->success = 1;
-  c_leader->barrier[0] = 0;
-  c_leader->barrier[1] = 0;
-  c_leader->stable++;
-  __sync_fetch_and_or(&c_leader->barrier[0], 1UL << core_id);
-  unsigned long failed_mask = 0;
-  while(c_leader->barrier[0] != mask) {
-    failed_mask = check_terms(snapshot);
-    failed_mask = failed_mask & mask;
-    if(failed_mask) {
-      c_leader->success = 0;
-      __sync_fetch_and_or(&c_leader->barrier[0], failed_mask);
+  rdv_tree_t t;
+  int me = 0;
+  t.count    = 0;
+  t.tag      = nonce->rtc_ts;
+  t.snapshot = snapshot;
+  for_each_core(c, mask) {
+    if(c == core_id) {
+      me = t.count;
     }
+    t.cores[t.count++] = c;
   }
-  /*
-  if(failed_mask) {
-    BOOST_LOG_TRIVIAL(info) << "Failed follower";
-    for(int i=0;i<executor_threads;i++) {
-      if(snapshot[core_to_quorum(i)] < core_status[i].exec_term) {
-	BOOST_LOG_TRIVIAL(info) << "core = "
-				<< i
-				<< " exec term = "
-				<< core_status[i].exec_term
-				<< " snapshot = "
-				<< snapshot[core_to_quorum(i)];
-      }
-    }
+  // Whoever waits on a failed core counts it as failed
+  if(rdv_failed(&t, core_id)) {
+    return 0;
   }
-  */
-  __sync_fetch_and_or(&c_leader->barrier[1], 1UL << core_id);
-  __sync_fetch_and_or(&c_leader->barrier[1], failed_mask);
-  while(c_leader->barrier[1] != mask);
-  if(failed_mask) {
+  if(me != 0 && rdv_failed(&t, t.cores[0])) {
     return 0;
   }
-  else {
-    return 1;
+  int ok = 1;
+  int wake[MAX_EXECUTOR_THREADS];
+  int wakes = 0;
+  for(int i=1;i<=barrier_fanout;i++) {
+    int child = me*barrier_fanout + i;
+    if(child >= t.count) {
+      break;
+    }
+    if(!rdv_gather(&t, child, &ok, wake, &wakes)) {
+      return 0;
+    }
+  }
+  core_status_t *cstatus = &core_status[core_id];
+  int success = ok;
+  if(me != 0) {
+    cstatus->arrive.ok = ok;
+    __sync_synchronize();
+    cstatus->arrive.tag = t.tag;
+    spin_wait_t w;
+    spin_wait_init(&w);
+    while(cstatus->release.tag != t.tag) {
+      if(rdv_failed(&t, t.cores[0])) {
+	return 0;
+      }
+      barrier_wait_step(&w, &cstatus->release);
+    }
+    __sync_synchronize();
+    success = cstatus->release.ok;
   }
+  for(int i=0;i<wakes;i++) {
+    core_status_t *c = &core_status[wake[i]];
+    c->release.ok = success;
+    __sync_synchronize();
+    c->release.tag = t.tag;
+  }
+  return success;
 }
 
 // Possble values for code
@@ -211,5 +369,9 @@ static const int RPC_REQ_NODEADD        = 4; // Add node
 static const int RPC_REQ_NODEDEL        = 5; // Delete node 
 static const int RPC_REP_OK             = 6; // RPC response OK
 static const int RPC_REP_FAIL           = 7; // RPC response FAILED 
+static const int RPC_REP_REJECT         = 8; // Over credit window, retry
+static const int RPC_REQ_REMAP          = 9; // Move a partition
+static const int RPC_REP_REMAP          = 10; // Stale partition map, retry
+static const int RPC_REP_REDIRECT       = 11; // Not the leader, see hint
 
 #endif
@@ -244,13 +244,13 @@ static void cyclone_prep_mbuf(dpdk_context_t *context,
   m->data_len = m->pkt_len;
 }
 
-static void cyclone_prep_mbuf_server2client(dpdk_context_t *context,
-					    int port,
-					    int dst,
-					    int dst_q,
-					    rte_mbuf *m,
-					    void *data,
-					    int size)
+// As below for a payload already in place after the ip header
+static void cyclone_prep_mbuf_server2client_inplace(dpdk_context_t *context,
+						    int port,
+						    int dst,
+						    int dst_q,
+						    rte_mbuf *m,
+						    int size)
 {
   struct ether_hdr *eth;
   eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
@@ -264,7 +264,6 @@ static void cyclone_prep_mbuf_server2client(dpdk_context_t *context,
 			 magic_src_ip, 
 			 dst_q,
 			 size);
-  rte_memcpy(ip + 1, data, size);
   
   ///////////////////////
   m->pkt_len = 
@@ -274,6 +273,28 @@ static void cyclone_prep_mbuf_server2client(dpdk_context_t *context,
   m->data_len = m->pkt_len;
 }
 
+static void cyclone_prep_mbuf_server2client(dpdk_context_t *context,
+					    int port,
+					    int dst,
+					    int dst_q,
+					    rte_mbuf *m,
+					    void *data,
+					    int size)
+{
+  cyclone_prep_mbuf_server2client_inplace(context,
+					  port,
+					  dst,
+					  dst_q,
+					  m,
+					  size);
+  rte_memcpy(rte_pktmbuf_mtod_offset(m, 
+				     void *, 
+				     sizeof(struct ether_hdr) + 
+				     sizeof(struct ipv4_hdr)), 
+	     data, 
+	     size);
+}
+
 
 static void cyclone_prep_mbuf_client2server(dpdk_context_t *context,
 					    int port,
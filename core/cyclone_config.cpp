@@ -0,0 +1,97 @@
+// Runtime execution resources for cyclone servers and clients
+#include<stdlib.h>
+#include <sstream>
+#include <string>
+#include <boost/property_tree/ini_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include "libcyclone.hpp"
+#include "logging.hpp"
+
+int executor_threads    = default_executor_threads;
+int num_quorums         = default_num_quorums;
+int Q_BUFS              = default_q_bufs;
+int rocksdb_num_threads = default_rocksdb_num_threads;
+int client_window       = credit_window_default;
+partition_map_t partition_map;
+static bool config_loaded = false;
+
+void cyclone_config_init(const char *config_quorum_path)
+{
+  if(config_loaded) {
+    return;
+  }
+  boost::property_tree::ptree pt_quorum;
+  boost::property_tree::read_ini(config_quorum_path, pt_quorum);
+  executor_threads = 
+    pt_quorum.get<int>("dispatch.executors", default_executor_threads);
+  num_quorums = 
+    pt_quorum.get<int>("dispatch.quorums", default_num_quorums);
+  Q_BUFS = 
+    pt_quorum.get<int>("dispatch.q_bufs", default_q_bufs);
+  rocksdb_num_threads = 
+    pt_quorum.get<int>("dispatch.rocksdb_threads", default_rocksdb_num_threads);
+  client_window = 
+    pt_quorum.get<int>("dispatch.client_window", credit_window_default);
+  if(executor_threads < 1 || executor_threads > MAX_EXECUTOR_THREADS) {
+    BOOST_LOG_TRIVIAL(fatal) << "executors must be in 1.."
+			     << MAX_EXECUTOR_THREADS;
+    exit(-1);
+  }
+  if(num_quorums < 1 || num_quorums > MAX_QUORUMS) {
+    BOOST_LOG_TRIVIAL(fatal) << "quorums must be in 1.." << MAX_QUORUMS;
+    exit(-1);
+  }
+  if(num_quorums > executor_threads) {
+    BOOST_LOG_TRIVIAL(fatal) << "Need at least one executor per quorum";
+    exit(-1);
+  }
+  if(Q_BUFS < 1 || rocksdb_num_threads < 1) {
+    BOOST_LOG_TRIVIAL(fatal) << "q_bufs and rocksdb_threads must be positive";
+    exit(-1);
+  }
+  if(client_window < 1 || client_window > credit_window_max) {
+    BOOST_LOG_TRIVIAL(fatal) << "client_window must be in 1.."
+			     << credit_window_max;
+    exit(-1);
+  }
+  partition_map.version    = 1;
+  partition_map.partitions = 
+    pt_quorum.get<int>("dispatch.partitions", executor_threads);
+  if(partition_map.partitions < 1 ||
+     partition_map.partitions > MAX_PARTITIONS) {
+    BOOST_LOG_TRIVIAL(fatal) << "partitions must be in 1.." << MAX_PARTITIONS;
+    exit(-1);
+  }
+  for(int p=0;p<partition_map.partitions;p++) {
+    partition_map.core[p] = p % executor_threads;
+  }
+  std::string map = pt_quorum.get<std::string>("dispatch.partition_map", "");
+  if(map.length() > 0) {
+    std::stringstream ss(map);
+    std::string item;
+    int p = 0;
+    while(std::getline(ss, item, ',')) {
+      int core = atoi(item.c_str());
+      if(p == partition_map.partitions || 
+	 core < 0 || 
+	 core >= executor_threads) {
+	BOOST_LOG_TRIVIAL(fatal) << "partition_map needs one core in 0.."
+				 << (executor_threads - 1)
+				 << " for each of "
+				 << partition_map.partitions << " partitions";
+	exit(-1);
+      }
+      partition_map.core[p++] = core;
+    }
+    if(p != partition_map.partitions) {
+      BOOST_LOG_TRIVIAL(fatal) << "partition_map lists " << p
+			       << " partitions, need "
+			       << partition_map.partitions;
+      exit(-1);
+    }
+  }
+  config_loaded = true;
+  BOOST_LOG_TRIVIAL(info) << "Executors = " << executor_threads
+			  << " quorums = " << num_quorums
+			  << " q_bufs = " << Q_BUFS;
+}
@@ -133,6 +133,67 @@ static void drop_eth_header(rte_mbuf *m)
   }
 }
 
+/* Raft -> executor handoff descriptor, a single ring element
+ * bits  0-3  : quorum
+ * bits  4-8  : segment of the mbuf chain holding the rpc
+ * bits  9-22 : offset of the rpc from that segment's buf_addr
+ * bits 23-63 : chain head address >> 6 (mbufs are cache line aligned)
+ */
+const int EXEC_DESC_QUORUM_BITS = 4;
+const int EXEC_DESC_SEG_BITS    = 5;
+const int EXEC_DESC_OFF_BITS    = 14;
+const int EXEC_DESC_PTR_SHIFT   =
+  EXEC_DESC_QUORUM_BITS + EXEC_DESC_SEG_BITS + EXEC_DESC_OFF_BITS;
+
+static void *exec_desc_encode(int quorum, rte_mbuf *head, rpc_t *rpc)
+{
+  unsigned long seg_no = 0;
+  rte_mbuf *seg = head;
+  while(seg != NULL) {
+    char *base = (char *)seg->buf_addr;
+    if((char *)rpc >= base && (char *)rpc < base + seg->buf_len) {
+      break;
+    }
+    seg = seg->next;
+    seg_no++;
+  }
+  if(seg == NULL ||
+     seg_no >= (1UL << EXEC_DESC_SEG_BITS) ||
+     quorum >= (1 << EXEC_DESC_QUORUM_BITS) ||
+     ((unsigned long)head & 63) != 0) {
+    BOOST_LOG_TRIVIAL(fatal) << "Unable to encode executor descriptor";
+    exit(-1);
+  }
+  unsigned long off = (char *)rpc - (char *)seg->buf_addr;
+  if(off >= (1UL << EXEC_DESC_OFF_BITS)) {
+    BOOST_LOG_TRIVIAL(fatal) << "Unable to encode executor descriptor";
+    exit(-1);
+  }
+  unsigned long desc = ((unsigned long)head >> 6) << EXEC_DESC_PTR_SHIFT;
+  desc |= off << (EXEC_DESC_QUORUM_BITS + EXEC_DESC_SEG_BITS);
+  desc |= seg_no << EXEC_DESC_QUORUM_BITS;
+  desc |= (unsigned long)quorum;
+  return (void *)desc;
+}
+
+static rte_mbuf *exec_desc_decode(void *d, int *quorum, rpc_t **rpc)
+{
+  unsigned long desc = (unsigned long)d;
+  rte_mbuf *head = (rte_mbuf *)((desc >> EXEC_DESC_PTR_SHIFT) << 6);
+  unsigned long seg_no =
+    (desc >> EXEC_DESC_QUORUM_BITS) & ((1UL << EXEC_DESC_SEG_BITS) - 1);
+  unsigned long off =
+    (desc >> (EXEC_DESC_QUORUM_BITS + EXEC_DESC_SEG_BITS)) &
+    ((1UL << EXEC_DESC_OFF_BITS) - 1);
+  rte_mbuf *seg = head;
+  while(seg_no--) {
+    seg = seg->next;
+  }
+  *quorum = (int)(desc & ((1UL << EXEC_DESC_QUORUM_BITS) - 1));
+  *rpc    = (rpc_t *)((char *)seg->buf_addr + off);
+  return head;
+}
+
 /* Message types */
 const int  MSG_REQUESTVOTE              = 1;
 const int  MSG_REQUESTVOTE_RESPONSE     = 2;
@@ -141,6 +202,7 @@ const int  MSG_APPENDENTRIES_RESPONSE   = 4;
 
 extern struct rte_ring ** to_cores;
 extern struct rte_ring ** to_quorums;
+extern struct rte_ring ** to_anycore;
 extern struct rte_ring *from_cores;
 extern dpdk_context_t *global_dpdk_context;
 
@@ -148,6 +210,24 @@ struct cyclone_monitor;
 struct cyclone_st;
 extern cyclone_st ** quorums;
 
+// Admission credits of one client, 32 to a cache line. inflight is
+// updated by the raft thread and executors. window is written for
+// every quorum by the quorum 0 raft thread, where clients send
+// RPC_REQ_STABLE, and only read by the others.
+typedef struct client_credit_st {
+  volatile unsigned char inflight;
+  volatile unsigned char window;
+} client_credit_t;
+
+// A request accepted and not yet finished, keyed by (client_id,
+// channel_seq). Filled in by the raft thread, cleared by the executor
+// finishing the request. since == 0 marks a free entry.
+typedef struct dedup_entry_st {
+  volatile int client;
+  volatile unsigned long seq;
+  volatile unsigned long since; // usecs
+} dedup_entry_t;
+
 typedef struct cyclone_st {
   boost::property_tree::ptree pt;
   boost::property_tree::ptree pt_client;
@@ -167,7 +247,9 @@ typedef struct cyclone_st {
   cyclone_monitor *monitor_obj;
   volatile int sending_checkpoints;
   volatile int *match_indices;
-  volatile char *client_inflight;
+  client_credit_t *client_credits; // max_clients + 1, last is internal
+  dedup_entry_t *dedup; // dedup_slots
+  int max_clients;
 
   msg_t ae_responses[PKT_BURST];
   int ae_response_sources[PKT_BURST];
@@ -182,19 +264,128 @@ typedef struct cyclone_st {
   
   volatile unsigned int snapshot;
 
-  char current_inflight(int client)
+  int internal_client()
   {
-    return client_inflight[client];
+    return max_clients;
+  }
+
+  bool admit(int client)
+  {
+    if(client < 0 || client >= max_clients) {
+      return false;
+    }
+    client_credit_t *c = &client_credits[client];
+    return c->inflight < c->window;
   }
 
   void add_inflight(int client)
   {
-    __sync_fetch_and_add(&client_inflight[client], 1);
+    __sync_fetch_and_add(&client_credits[client].inflight, 1);
   }
 
   void remove_inflight(int client)
   {
-    __sync_fetch_and_sub(&client_inflight[client], 1);
+    __sync_fetch_and_sub(&client_credits[client].inflight, 1);
+  }
+
+  dedup_entry_t *dedup_slot(int client, unsigned long seq, int i)
+  {
+    unsigned long h = (seq*0x9e3779b97f4a7c15UL) ^ (unsigned long)client;
+    return &dedup[(h + i) & (dedup_slots - 1)];
+  }
+
+  // Raft thread: true if the request is a resend of one still in flight
+  bool in_flight(rpc_t *rpc)
+  {
+    unsigned long now = rtc_clock::current_time();
+    for(int i=0;i<dedup_probe;i++) {
+      dedup_entry_t *e = dedup_slot(rpc->client_id, rpc->channel_seq, i);
+      unsigned long since = e->since;
+      if(since != 0 &&
+	 now - since < dedup_expire_usecs &&
+	 e->client == rpc->client_id &&
+	 e->seq == rpc->channel_seq) {
+	return true;
+      }
+    }
+    return false;
+  }
+
+  // Raft thread: the request goes on to execute, best effort when no
+  // probe slot is free
+  void remember(rpc_t *rpc)
+  {
+    unsigned long now = rtc_clock::current_time();
+    for(int i=0;i<dedup_probe;i++) {
+      dedup_entry_t *e = dedup_slot(rpc->client_id, rpc->channel_seq, i);
+      unsigned long since = e->since;
+      if(since == 0 || now - since >= dedup_expire_usecs) {
+	e->client = rpc->client_id;
+	e->seq    = rpc->channel_seq;
+	__sync_synchronize();
+	e->since  = now;
+	return;
+      }
+    }
+  }
+
+  // Executor: the request is done, resends are new requests again
+  void forget(rpc_t *rpc)
+  {
+    for(int i=0;i<dedup_probe;i++) {
+      dedup_entry_t *e = dedup_slot(rpc->client_id, rpc->channel_seq, i);
+      if(e->since != 0 &&
+	 e->client == rpc->client_id &&
+	 e->seq == rpc->channel_seq) {
+	e->since = 0;
+	return;
+      }
+    }
+  }
+
+  // Answer a request from the raft thread and drop it
+  void reply_drop(rte_mbuf *m, rpc_t *rpc, int code, void *payload, int sz)
+  {
+    rte_mbuf *r = rte_pktmbuf_alloc(global_dpdk_context->mempools[my_q(q_raft)]);
+    if(r != NULL) {
+      char rep_buf[sizeof(rpc_t) + sizeof(leader_hint_t)];
+      rpc_t *rep = (rpc_t *)rep_buf;
+      memcpy(rep, rpc, sizeof(rpc_t));
+      rep->code       = code;
+      rep->payload_sz = sz;
+      if(sz > 0) {
+	memcpy(rep + 1, payload, sz);
+      }
+      cyclone_prep_mbuf_server2client(global_dpdk_context,
+				      queue2port(my_q(q_raft), 
+						 global_dpdk_context->ports),
+				      rpc->requestor,
+				      rpc->client_port,
+				      r,
+				      rep,
+				      sizeof(rpc_t) + sz);
+      if(cyclone_tx(global_dpdk_context, r, my_q(q_raft))) {
+	BOOST_LOG_TRIVIAL(warning) << "Failed to send reply to client";
+      }
+    }
+    rte_pktmbuf_free(m);
+  }
+
+  // Tell a client over its window to back off instead of dropping the
+  // request, it would otherwise time out and fail over
+  void reject(rte_mbuf *m, rpc_t *rpc)
+  {
+    reply_drop(m, rpc, RPC_REP_REJECT, NULL, 0);
+  }
+
+  // Tell a client which replica leads instead of letting it time out
+  // and probe replicas in turn
+  void redirect(rte_mbuf *m, rpc_t *rpc)
+  {
+    leader_hint_t hint;
+    hint.leader = raft_get_current_leader(raft_handle);
+    hint.term   = raft_get_current_term(raft_handle);
+    reply_drop(m, rpc, RPC_REP_REDIRECT, &hint, sizeof(leader_hint_t));
   }
   
 
@@ -334,9 +525,11 @@ typedef struct cyclone_st {
 }cyclone_t;
 
 // Non blocking, best effort
-static int take_snapshot(unsigned int *snapshot)
+template<int QUORUMS>
+static int take_snapshot_fixed(unsigned int *snapshot, int quorum_cnt)
 {
-  for(int i=0;i<num_quorums;i++) {
+  const int cnt = (QUORUMS > 0) ? QUORUMS:quorum_cnt;
+  for(int i=0;i<cnt;i++) {
     snapshot[i] = quorums[i]->snapshot;
     if((snapshot[i] & 1) == 0) {
       return 0;
@@ -344,13 +537,28 @@ static int take_snapshot(unsigned int *snapshot)
   }
   __sync_synchronize();
   // check snapshot
-  for(int i=0;i<num_quorums;i++) {
+  for(int i=0;i<cnt;i++) {
     if(snapshot[i] != quorums[i]->snapshot) {
       return 0;
     }
   }
   return 1; // success
 }
+
+// Specialised for common quorum counts, unrolls on the RO/STABLE path
+static int take_snapshot(unsigned int *snapshot)
+{
+  switch(num_quorums) {
+  case 4:
+    return take_snapshot_fixed<4>(snapshot, 4);
+  case 8:
+    return take_snapshot_fixed<8>(snapshot, 8);
+  case 16:
+    return take_snapshot_fixed<16>(snapshot, 16);
+  default:
+    return take_snapshot_fixed<0>(snapshot, num_quorums);
+  }
+}
   
 struct cyclone_monitor {
   volatile bool terminate;
@@ -455,13 +663,22 @@ struct cyclone_monitor {
       else {
 	rpc = rte_pktmbuf_mtod(m, rpc_t *);
       }
-      int core = __builtin_ffsl(rpc->core_mask) - 1;
+      int core = core_mask_first(rpc->core_mask);
+      if(!multicore && !(cyclone_handle->snapshot & 1)) {
+	cyclone_handle->redirect(m, rpc);
+	continue;
+      }
       // Admission control
       if(!multicore) {
-	if(cyclone_handle->current_inflight(rpc->client_id) >= MAX_INFLIGHT) {
+	// A resend of a request still in flight, its reply is on the way
+	if(cyclone_handle->in_flight(rpc)) {
 	  rte_pktmbuf_free(m);
 	  continue;
 	}
+	if(!cyclone_handle->admit(rpc->client_id)) {
+	  cyclone_handle->reject(m, rpc);
+	  continue;
+	}
       }
       if(!multicore && is_multicore_rpc(rpc)) {
 	// Received a multi-core operation
@@ -470,21 +687,23 @@ struct cyclone_monitor {
 	  rte_pktmbuf_free(m);
 	  continue;
 	}
-	if(rpc->core_mask > ((1UL << executor_threads) - 1)) {
-	  BOOST_LOG_TRIVIAL(fatal) << "Invalid core mask " << rpc->core_mask;
+	core_mask_t invalid = core_mask_andnot(rpc->core_mask,
+					       all_cores_mask());
+	if(!core_mask_empty(invalid)) {
+	  BOOST_LOG_TRIVIAL(fatal) << "Invalid core in mask "
+				   << core_mask_first(invalid);
 	  exit(-1);
 	}
+	cyclone_handle->remember(rpc);
 	ic_rdv_t *rdv = rpc2rdv(rpc);
 	rdv->rtc_ts = cyclone_handle->nonce_base + rte_get_tsc_cycles();
 	memcpy(&rdv->mc_id, 
 	       global_dpdk_context->mc_addresses[global_dpdk_context->me],
 	       6);
 	unsigned long quorum_mask = 0;
-	unsigned long t = rpc->core_mask;
-	while(t) {
-	  int c = __builtin_ffsl(t) - 1;
-	  quorum_mask |= (1 << core_to_quorum(c));
-	  t = t & ~(1UL << c);
+	core_mask_t cores = rpc->core_mask;
+	for_each_core(c, cores) {
+	  quorum_mask |= (1UL << core_to_quorum(c));
 	}
 	// Delete all headers and enqueue to quorums
 	if(rte_pktmbuf_adj(m, ((char *)rpc) - rte_pktmbuf_mtod(m, char *)) == NULL) {
@@ -505,14 +724,34 @@ struct cyclone_monitor {
       }
       if(rpc->code == RPC_REQ_STABLE) {
 	if(take_snapshot(snapshot)) {
-	  rte_pktmbuf_append(m, num_quorums*sizeof(unsigned int));
+	  // Grant the credit window asked for, returned after the terms
+	  int window = credit_window_default;
+	  if(rpc->payload_sz >= (int)sizeof(int)) {
+	    window = *(int *)(rpc + 1);
+	  }
+	  if(window < 1) {
+	    window = 1;
+	  }
+	  else if(window > credit_window_max) {
+	    window = credit_window_max;
+	  }
+	  for(int q=0;q<num_quorums && cyclone_handle->me_quorum == 0;q++) {
+	    quorums[q]->client_credits[rpc->client_id].window = window;
+	  }
+	  // and the partition map after the window. A copy racing a
+	  // partition move may be stale, the client is then corrected by
+	  // RPC_REP_REMAP.
+	  rte_pktmbuf_append(m, 
+			     num_quorums*sizeof(unsigned int) + 
+			     sizeof(int) +
+			     partition_map_size(&partition_map));
 	  memcpy(rpc + 1, snapshot, num_quorums*sizeof(unsigned int));
-	  void *triple[3];
-	  triple[0] = (void *)(unsigned long)cyclone_handle->me_quorum;
-	  triple[1] = m;
-	  triple[2] = rpc;
+	  int *window_ptr = (int *)(((unsigned int *)(rpc + 1)) + num_quorums);
+	  *window_ptr = window;
+	  partition_map_copy(window_ptr + 1);
+	  void *desc = exec_desc_encode(cyclone_handle->me_quorum, m, rpc);
 	  cyclone_handle->add_inflight(rpc->client_id);
-	  if(rte_ring_mp_enqueue_bulk(to_cores[core], triple, 3) == -ENOBUFS) {
+	  if(rte_ring_mp_enqueue(to_cores[core], desc) == -ENOBUFS) {
 	    BOOST_LOG_TRIVIAL(fatal) << "raft->core comm ring is full (req stable)";
 	    exit(-1);
 	  }
@@ -546,12 +785,16 @@ struct cyclone_monitor {
       }
       if(rpc->flags & RPC_FLAG_RO) {
 	if(cyclone_handle->snapshot & 1) { // is leader
-	  void *triple[3];
-	  triple[0] = (void *)(unsigned long)cyclone_handle->me_quorum;
-	  triple[1] = m;
-	  triple[2] = rpc;
+	  void *desc = exec_desc_encode(cyclone_handle->me_quorum, m, rpc);
+	  struct rte_ring *ring = to_cores[core];
+	  if(to_anycore != NULL && 
+	     (rpc->flags & RPC_FLAG_ANYCORE) &&
+	     !is_multicore_rpc(rpc)) {
+	    ring = to_anycore[cyclone_handle->me_quorum];
+	  }
 	  cyclone_handle->add_inflight(rpc->client_id);
-	  if(rte_ring_mp_enqueue_bulk(to_cores[core], triple, 3) == -ENOBUFS) {
+	  cyclone_handle->remember(rpc);
+	  if(rte_ring_mp_enqueue(ring, desc) == -ENOBUFS) {
 	    BOOST_LOG_TRIVIAL(fatal) << "raft->core comm ring is full (req ro)";
 	    exit(-1);
 	  }
@@ -561,7 +804,10 @@ struct cyclone_monitor {
 	}
 	continue;
       }
-      else if(rpc->code == RPC_REQ_NODEDEL) {
+      if(!multicore) {
+	cyclone_handle->remember(rpc);
+      }
+      if(rpc->code == RPC_REQ_NODEDEL) {
 	messages[accepted].data.buf = (void *)m;
 	messages[accepted].data.len = pktadj2rpcsz(m);
 	messages[accepted].type = RAFT_LOGTYPE_REMOVE_NODE;
@@ -708,13 +954,15 @@ struct cyclone_monitor {
 	  k_rpc->code       = RPC_REQ_KICKER;
 	  k_rpc->flags      = 0;
 	  k_rpc->payload_sz = 0;
-	  k_rpc->core_mask  = 0;
-	  k_rpc->client_id  = MAX_CLIENTS - 1; // Really don't care
+	  k_rpc->client_id  = cyclone_handle->internal_client();
+	  k_rpc->partition  = -1;
+	  core_mask_t k_mask = core_mask_none();
 	  for(int i = 0;i<executor_threads;i++) {
 	    if(core_to_quorum(i) == cyclone_handle->me_quorum) {
-	      k_rpc->core_mask |= (1UL << i);
+	      core_mask_set(&k_mask, i);
 	    }
 	  }
+	  k_rpc->core_mask  = k_mask;
 	  pktsetrpcsz(k, sizeof(rpc_t));
 	  adjust_head(k);
 	  messages[0].data.buf = (void *)k;
@@ -11,6 +11,82 @@
 
 
 extern dpdk_context_t *global_dpdk_context;
+
+// Retransmit timeout for a server from its smoothed RTT and variance
+typedef struct rtt_estimator_st {
+  unsigned long samples;
+  unsigned long srtt;   // usecs
+  unsigned long rttvar; // usecs
+  unsigned long rto;    // usecs
+
+  void init()
+  {
+    samples = 0;
+    srtt    = 0;
+    rttvar  = 0;
+    rto     = rto_initial_usec;
+  }
+
+  // Only replies to requests sent once, which send is answered is
+  // ambiguous after a retransmit (Karn)
+  void sample(unsigned long r)
+  {
+    if(samples++ == 0) {
+      srtt   = r;
+      rttvar = r/2;
+    }
+    else {
+      unsigned long delta = (srtt > r) ? (srtt - r):(r - srtt);
+      rttvar = (3*rttvar + delta)/4;
+      srtt   = (7*srtt + r)/8;
+    }
+    rto = srtt + 4*rttvar;
+    if(rto < rto_min_usec) {
+      rto = rto_min_usec;
+    }
+    else if(rto > rto_max_usec) {
+      rto = rto_max_usec;
+    }
+  }
+
+  // Wait for the reply to the retransmits'th resend
+  unsigned long timeout(int retransmits)
+  {
+    unsigned long t = rto;
+    for(int i=0;i<retransmits && t < rto_max_usec;i++) {
+      t = 2*t;
+    }
+    return (t < rto_max_usec) ? t:rto_max_usec;
+  }
+
+  unsigned long failover_usec()
+  {
+    unsigned long t = rto_failover_rtos*rto;
+    return (t > timeout_msec*1000UL) ? t:timeout_msec*1000UL;
+  }
+} rtt_estimator_t;
+
+// Asynchronous request, kept until its reply arrives to be resent
+typedef struct async_rpc_st {
+  bool busy;
+  unsigned long seq; // Same on every send, any reply completes it
+  void *tag;
+  int flags;
+  int partition;
+  core_mask_t core_mask;
+  int quorum;
+  int sz;
+  int server;
+  int retransmits;
+  bool replied; // Reply in response, waiting for poll to hand it out
+  int response_sz;
+  unsigned long first_send; // usecs
+  unsigned long deadline;  // usecs
+  unsigned long resend_at; // usecs, 0 when awaiting a reply
+  char *payload;
+  char *response;
+} async_rpc_t;
+
 typedef struct rpc_client_st {
   int me;
   int me_mc;
@@ -26,23 +102,30 @@ typedef struct rpc_client_st {
   dpdk_rx_buffer_t *buf;
   int server_ports;
   unsigned int *terms;
+  int window; // Credits granted by the server
+  partition_map_t *map;
+  async_rpc_t *async; // Indexed by channel_seq % client_async_max
+  int async_cnt;
+  int async_replied;
+  int async_inflight[MAX_QUORUMS];
+  rtt_estimator_t *rtt; // Per server
 
   int quorum_q(int quorum_id, int q)
   {
     return server_ports + q*num_quorums + quorum_id;
   }
   
-  int choose_quorum(unsigned long core_mask)
+  int choose_quorum(core_mask_t core_mask)
   {
-    if(core_mask & (core_mask - 1)) {
+    if(core_mask_is_multi(core_mask)) {
       return 0;
     }
     else {
-      return core_to_quorum(__builtin_ffsl(core_mask) - 1);
+      return core_to_quorum(core_mask_first(core_mask));
     }
   }
 
-  int common_receive_loop(int blob_sz)
+  int common_receive_loop(unsigned long timeout_usecs)
   {
     int resp_sz;
     rte_mbuf *junk[PKT_BURST];
@@ -62,13 +145,16 @@ typedef struct rpc_client_st {
 				   buf,
 				   (unsigned char *)packet_in,
 				   MSG_MAXSIZE,
-				   timeout_msec*1000);
+				   timeout_usecs);
       if(resp_sz == -1) {
 	break;
       }
 
       if(packet_in->channel_seq != (channel_seq - 1)) {
-	BOOST_LOG_TRIVIAL(warning) << "Channel seq mismatch";
+	// Asynchronous requests answered while probing for a leader
+	if(!async_reply(resp_sz)) {
+	  BOOST_LOG_TRIVIAL(warning) << "Channel seq mismatch";
+	}
 	continue;
       }
       
@@ -77,6 +163,21 @@ typedef struct rpc_client_st {
     return resp_sz;
   }
 
+  // Take a map sent by the server unless ours is newer
+  void adopt_map(const void *buf, int len)
+  {
+    const partition_map_t *m = (const partition_map_t *)buf;
+    if(len < (int)(2*sizeof(int)) ||
+       m->partitions < 1 || 
+       m->partitions > MAX_PARTITIONS ||
+       len < partition_map_size(m)) {
+      return;
+    }
+    if(m->version >= map->version) {
+      memcpy(map, m, partition_map_size(m));
+    }
+  }
+
   void send_to_server(rpc_t *pkt, int sz, int quorum_id)
   {
     rte_mbuf *mb = rte_pktmbuf_alloc(global_dpdk_context->mempools[me_queue]);
@@ -99,26 +200,107 @@ typedef struct rpc_client_st {
 
 
   
+  // Send and wait for the reply, resending to the same server on its
+  // RTO. Returns -1 once the request has gone unanswered long enough to
+  // fail over.
+  // The server drops resends of a request it is still executing, so a
+  // RPC_REP_REJECT to a resend means none is: back off and resend under
+  // the same seq, a new one could run the request twice.
+  int send_and_wait(rpc_t *pkt, int sz, int quorum_id)
+  {
+    rtt_estimator_t *est = &rtt[server];
+    unsigned long first = rtc_clock::current_time();
+    for(int r=0;;r++) {
+      send_to_server(pkt, sz, quorum_id);
+      int resp_sz = common_receive_loop(est->timeout(r));
+      unsigned long now = rtc_clock::current_time();
+      if(resp_sz != -1) {
+	if(r > 0 && packet_in->code == RPC_REP_REJECT) {
+	  rte_delay_us(credit_reject_backoff_usec);
+	}
+	else {
+	  if(r == 0) {
+	    est->sample(now - first);
+	  }
+	  return resp_sz;
+	}
+      }
+      if(now - first >= est->failover_usec()) {
+	return -1;
+      }
+    }
+  }
+
+  // Take the leader named by a RPC_REP_REDIRECT in packet_in, returns
+  // 0 if it names none other than the current server
+  int follow_hint()
+  {
+    leader_hint_t *hint = (leader_hint_t *)(packet_in + 1);
+    if(hint->leader < 0 || 
+       hint->leader >= replicas || 
+       hint->leader == server) {
+      return 0;
+    }
+    BOOST_LOG_TRIVIAL(info) << "Redirected to leader " << hint->leader
+			    << " term " << hint->term;
+    server = hint->leader;
+    return 1;
+  }
+
   int set_server()
+  {
+    // Followers name the leader, a hint to a replica that lost the
+    // leadership since is followed too but not forever
+    for(int hops=0;hops<replicas;hops++) {
+      int resp_sz = probe_server();
+      if(resp_sz != -1 && packet_in->code == RPC_REP_REDIRECT) {
+	if(follow_hint()) {
+	  continue;
+	}
+	rte_delay_us(redirect_backoff_usec); // Election in progress
+      }
+      return resp_sz != -1 && packet_in->code == RPC_REP_OK;
+    }
+    return 0;
+  }
+
+  // Ask the server for its terms, returns the reply size
+  int probe_server()
   {
     packet_out_aux->code        = RPC_REQ_STABLE;
     packet_out_aux->flags       = 0;
-    packet_out_aux->core_mask   = 1; // Always core 0
+    packet_out_aux->core_mask   = core_mask_single(0); // Always core 0
     packet_out_aux->client_port = me_queue;
     packet_out_aux->channel_seq = channel_seq++;
     packet_out_aux->client_id   = me;
     packet_out_aux->requestor   = me_mc;
-    packet_out_aux->payload_sz  = 0;
-    send_to_server(packet_out_aux, sizeof(rpc_t), 0); // always quorum 0
-    int resp_sz = common_receive_loop(sizeof(rpc_t));
-    if(resp_sz != -1) {
+    packet_out_aux->partition   = -1;
+    packet_out_aux->payload_sz  = sizeof(int);
+    *(int *)(packet_out_aux + 1) = client_window;
+    // always quorum 0
+    int resp_sz = send_and_wait(packet_out_aux, sizeof(rpc_t) + sizeof(int), 0);
+    if(resp_sz != -1 && packet_in->code == RPC_REP_OK) {
       memcpy(terms, packet_in + 1, num_quorums*sizeof(unsigned int));
       for(int i=0;i<num_quorums;i++) {
 	terms[i] = terms[i] >> 1;
       }
-      return 1;
+      window = credit_window_default;
+      int consumed = sizeof(rpc_t) + num_quorums*sizeof(unsigned int);
+      if(resp_sz >= (int)(consumed + sizeof(int))) {
+	int *window_ptr = (int *)(((unsigned int *)(packet_in + 1)) + num_quorums);
+	window = *window_ptr;
+	adopt_map(window_ptr + 1, resp_sz - consumed - sizeof(int));
+      }
+    }
+    return resp_sz;
+  }
+
+  // A follower answered, go to the leader it names in one round trip
+  void redirected(const char *context)
+  {
+    if(!follow_hint() || !set_server()) {
+      update_server(context);
     }
-    return 0;
   }
 
   void update_server(const char *context)
@@ -137,7 +319,7 @@ typedef struct rpc_client_st {
 
 
 
-  int delete_node(unsigned long core_mask, int nodeid)
+  int delete_node(core_mask_t core_mask, int nodeid)
   {
     int retcode;
     int resp_sz;
@@ -145,6 +327,7 @@ typedef struct rpc_client_st {
     while(true) {
       packet_out->code        = RPC_REQ_NODEDEL;
       packet_out->flags       = 0;
+      packet_out->partition   = -1;
       packet_out->core_mask   = core_mask;
       packet_out->client_port = me_queue;
       packet_out->channel_seq = channel_seq++;
@@ -153,8 +336,9 @@ typedef struct rpc_client_st {
       packet_out->payload_sz  = sizeof(cfg_change_t);
       cfg_change_t *cfg = (cfg_change_t *)(packet_out + 1);
       cfg->node = nodeid;
-      send_to_server(packet_out, sizeof(rpc_t) + sizeof(cfg_change_t), quorum_id);
-      resp_sz = common_receive_loop(sizeof(rpc_t) + sizeof(cfg_change_t));
+      resp_sz = send_and_wait(packet_out, 
+			      sizeof(rpc_t) + sizeof(cfg_change_t), 
+			      quorum_id);
       if(resp_sz == -1) {
 	update_server("rx timeout");
 	continue;
@@ -162,12 +346,20 @@ typedef struct rpc_client_st {
       if(packet_in->code == RPC_REP_FAIL) {
 	continue;
       }
+      if(packet_in->code == RPC_REP_REJECT) {
+	rte_delay_us(credit_reject_backoff_usec);
+	continue;
+      }
+      if(packet_in->code == RPC_REP_REDIRECT) {
+	redirected("redirected by follower");
+	continue;
+      }
       break;
     }
     return 0;
   }
 
-  int add_node(unsigned long core_mask, int nodeid)
+  int add_node(core_mask_t core_mask, int nodeid)
   {
     int retcode;
     int resp_sz;
@@ -175,6 +367,7 @@ typedef struct rpc_client_st {
     while(true) {
       packet_out->code        = RPC_REQ_NODEADD;
       packet_out->flags       = 0;
+      packet_out->partition   = -1;
       packet_out->core_mask     = core_mask;
       packet_out->client_port = me_queue;
       packet_out->channel_seq = channel_seq++;
@@ -183,8 +376,9 @@ typedef struct rpc_client_st {
       packet_out->payload_sz  = sizeof(cfg_change_t);
       cfg_change_t *cfg = (cfg_change_t *)(packet_out + 1);
       cfg->node      = nodeid;
-      send_to_server(packet_out, sizeof(rpc_t) + sizeof(cfg_change_t), quorum_id);
-      resp_sz = common_receive_loop(sizeof(rpc_t) + sizeof(cfg_change_t));
+      resp_sz = send_and_wait(packet_out, 
+			      sizeof(rpc_t) + sizeof(cfg_change_t), 
+			      quorum_id);
       if(resp_sz == -1) {
 	update_server("rx timeout");
 	continue;
@@ -192,47 +386,73 @@ typedef struct rpc_client_st {
       if(packet_in->code == RPC_REP_FAIL) {
 	continue;
       }
+      if(packet_in->code == RPC_REP_REJECT) {
+	rte_delay_us(credit_reject_backoff_usec);
+	continue;
+      }
+      if(packet_in->code == RPC_REP_REDIRECT) {
+	redirected("redirected by follower");
+	continue;
+      }
       break;
     }
     return 0;
   }
 
-  int make_rpc(void *payload, int sz, void **response, unsigned long core_mask, int flags)
+  // Fill in packet_out but for channel_seq, returns its size
+  int build_request(int code,
+		    void *payload,
+		    int sz,
+		    core_mask_t core_mask,
+		    int flags,
+		    int partition)
+  {
+    packet_out->code        = code;
+    packet_out->flags       = flags;
+    packet_out->partition   = partition;
+    packet_out->core_mask   = core_mask;
+    packet_out->client_port = me_queue;
+    packet_out->client_id   = me;
+    packet_out->requestor   = me_mc;
+    if(core_mask_is_multi(core_mask)) {
+      char *user_data = (char *)(packet_out + 1);
+      memcpy(user_data, terms, num_quorums*sizeof(unsigned int));
+      user_data += num_quorums*sizeof(unsigned int);
+      user_data += sizeof(ic_rdv_t);
+      memcpy(user_data, payload, sz);
+      packet_out->payload_sz  = 
+	num_quorums*sizeof(unsigned int) +
+	sizeof(ic_rdv_t) + 
+	sz;
+    }
+    else {
+      packet_out->payload_sz = sz;
+      memcpy(packet_out + 1, payload, sz);
+    }
+    return packet_out->payload_sz + sizeof(rpc_t);
+  }
+
+  // Partition routed calls take the core from the map on every try
+  int call(int code,
+	   void *payload, 
+	   int sz, 
+	   void **response, 
+	   core_mask_t core_mask, 
+	   int flags,
+	   int partition)
   {
     int retcode;
     int resp_sz;
-    int quorum_id = choose_quorum(core_mask);
+    int quorum_id;
     while(true) {
+      if(partition >= 0) {
+	core_mask = core_mask_single(map->core[partition]);
+      }
+      quorum_id = choose_quorum(core_mask);
       // Make request
-      packet_out->code        = RPC_REQ;
-      packet_out->flags       = flags;
-      packet_out->core_mask   = core_mask;
-      packet_out->client_port = me_queue;
+      int pkt_sz = build_request(code, payload, sz, core_mask, flags, partition);
       packet_out->channel_seq = channel_seq++;
-      packet_out->client_id   = me;
-      packet_out->requestor   = me_mc;
-      if((core_mask & (core_mask - 1)) != 0) {
-	char *user_data = (char *)(packet_out + 1);
-	memcpy(user_data, terms, num_quorums*sizeof(unsigned int));
-	user_data += num_quorums*sizeof(unsigned int);
-	user_data += sizeof(ic_rdv_t);
-	memcpy(user_data, payload, sz);
-	packet_out->payload_sz  = 
-	  num_quorums*sizeof(unsigned int) +
-	  sizeof(ic_rdv_t) + 
-	  sz;
-	unsigned int pkt_sz =  packet_out->payload_sz + sizeof(rpc_t);
-	send_to_server(packet_out, 
-		       pkt_sz,
-		       quorum_id);
-	resp_sz = common_receive_loop(pkt_sz);
-      }
-      else {
-	packet_out->payload_sz = sz;
-	memcpy(packet_out + 1, payload, sz);
-	send_to_server(packet_out, sizeof(rpc_t) + sz, quorum_id);
-	resp_sz = common_receive_loop(sizeof(rpc_t) + sz);
-      }
+      resp_sz = send_and_wait(packet_out, pkt_sz, quorum_id);
       if(resp_sz == -1) {
 	update_server("rx timeout, make rpc");
 	continue;
@@ -240,11 +460,252 @@ typedef struct rpc_client_st {
       if(packet_in->code == RPC_REP_FAIL) {
 	continue;
       }
+      if(packet_in->code == RPC_REP_REJECT) {
+	rte_delay_us(credit_reject_backoff_usec);
+	continue;
+      }
+      if(packet_in->code == RPC_REP_REDIRECT) {
+	redirected("redirected by follower");
+	continue;
+      }
+      if(packet_in->code == RPC_REP_REMAP) {
+	adopt_map(packet_in + 1, resp_sz - sizeof(rpc_t));
+	if(partition >= map->partitions) {
+	  BOOST_LOG_TRIVIAL(fatal) << "Partition " << partition
+				   << " is not in the server's map";
+	  exit(-1);
+	}
+	continue;
+      }
       break;
     }
     *response = (void *)(packet_in + 1);
     return (int)(resp_sz - sizeof(rpc_t));
   }
+
+  int make_rpc(void *payload, int sz, void **response, core_mask_t core_mask, int flags)
+  {
+    return call(RPC_REQ, payload, sz, response, core_mask, flags, -1);
+  }
+
+  // (Re)send an asynchronous request, routed afresh unless resending
+  // one left unanswered
+  void async_send(async_rpc_t *a, bool retransmit)
+  {
+    unsigned long now = rtc_clock::current_time();
+    if(retransmit) {
+      a->retransmits++;
+    }
+    else {
+      if(a->partition >= 0) {
+	a->core_mask = core_mask_single(map->core[a->partition]);
+      }
+      async_inflight[a->quorum]--;
+      a->quorum = choose_quorum(a->core_mask);
+      async_inflight[a->quorum]++;
+      a->server      = server;
+      a->retransmits = 0;
+      a->first_send  = now;
+    }
+    int pkt_sz = build_request(RPC_REQ, 
+			       a->payload, 
+			       a->sz, 
+			       a->core_mask, 
+			       a->flags, 
+			       a->partition);
+    packet_out->channel_seq = a->seq;
+    send_to_server(packet_out, pkt_sz, a->quorum);
+    a->deadline  = now + rtt[a->server].timeout(a->retransmits);
+    a->resend_at = 0;
+  }
+
+  // Keep a final reply in packet_in for its asynchronous request until
+  // poll hands it out, returns 0 if it completes none
+  int async_reply(int resp_sz)
+  {
+    if(async == NULL) {
+      return 0;
+    }
+    async_rpc_t *a = &async[packet_in->channel_seq % client_async_max];
+    if(!a->busy || a->replied || a->seq != packet_in->channel_seq) {
+      return 0;
+    }
+    if(packet_in->code == RPC_REP_FAIL ||
+       packet_in->code == RPC_REP_REJECT ||
+       packet_in->code == RPC_REP_REMAP ||
+       packet_in->code == RPC_REP_REDIRECT) {
+      return 1; // Resent by poll
+    }
+    if(a->retransmits == 0 && a->server == server) {
+      rtt[server].sample(rtc_clock::current_time() - a->first_send);
+    }
+    memcpy(a->response, packet_in + 1, resp_sz - sizeof(rpc_t));
+    a->response_sz = resp_sz - sizeof(rpc_t);
+    a->replied = true;
+    async_replied++;
+    async_inflight[a->quorum]--;
+    return 1;
+  }
+
+  int make_rpc_async(void *payload, 
+		     int sz, 
+		     core_mask_t core_mask, 
+		     int flags, 
+		     int partition,
+		     void *tag)
+  {
+    if(async == NULL) {
+      async = (async_rpc_t *)calloc(client_async_max, sizeof(async_rpc_t));
+    }
+    if(partition >= 0) {
+      core_mask = core_mask_single(map->core[partition]);
+    }
+    int quorum = choose_quorum(core_mask);
+    if(async_cnt == client_async_max || async_inflight[quorum] >= window) {
+      return -1;
+    }
+    // Sequence numbers carry the slot
+    int slot = 0;
+    while(async[slot].busy) {
+      slot++;
+    }
+    async_rpc_t *a = &async[slot];
+    if(a->payload == NULL) {
+      a->payload  = new char[DISP_MAX_MSGSIZE];
+      a->response = new char[MSG_MAXSIZE];
+    }
+    a->busy      = true;
+    a->replied   = false;
+    a->seq       = (channel_seq++)*client_async_max + slot;
+    a->tag       = tag;
+    a->flags     = flags;
+    a->partition = partition;
+    a->core_mask = core_mask;
+    a->quorum    = quorum;
+    a->sz        = sz;
+    memcpy(a->payload, payload, sz);
+    async_cnt++;
+    async_inflight[quorum]++;
+    async_send(a, false);
+    return 0;
+  }
+
+  int poll(rpc_completion_t *completions, int max)
+  {
+    if(async_cnt == 0) {
+      return 0;
+    }
+    unsigned long now = rtc_clock::current_time();
+    bool moved = false; // Found a new leader, resend all
+    while(async_replied < max) {
+      int resp_sz = cyclone_rx_buffered(global_dpdk_context,
+					0,
+					me_queue,
+					buf,
+					(unsigned char *)packet_in,
+					MSG_MAXSIZE);
+      if(resp_sz < 0) {
+	break;
+      }
+      async_rpc_t *a = &async[packet_in->channel_seq % client_async_max];
+      if(!a->busy || a->replied || a->seq != packet_in->channel_seq) {
+	continue; // Late reply to a completed request
+      }
+      if(packet_in->code == RPC_REP_FAIL) {
+	a->resend_at = now;
+	continue;
+      }
+      if(packet_in->code == RPC_REP_REJECT) {
+	a->resend_at = now + credit_reject_backoff_usec;
+	continue;
+      }
+      if(packet_in->code == RPC_REP_REMAP) {
+	adopt_map(packet_in + 1, resp_sz - sizeof(rpc_t));
+	a->resend_at = now;
+	continue;
+      }
+      if(packet_in->code == RPC_REP_REDIRECT) {
+	if(!moved) { // Others sent to the same follower follow suit
+	  redirected("redirected by follower, async rpc");
+	  moved = true;
+	}
+	continue;
+      }
+      async_reply(resp_sz);
+    }
+    bool timed_out = false;
+    for(int i=0, seen=0;seen<async_cnt;i++) {
+      async_rpc_t *a = &async[i];
+      if(!a->busy) {
+	continue;
+      }
+      seen++;
+      if(a->replied) {
+	continue;
+      }
+      if(a->resend_at != 0 && now >= a->resend_at) {
+	async_send(a, false);
+      }
+      else if(a->resend_at == 0 && now >= a->deadline) {
+	if(now - a->first_send >= rtt[a->server].failover_usec()) {
+	  timed_out = true;
+	}
+	else {
+	  async_send(a, true);
+	}
+      }
+    }
+    if(timed_out && !moved) {
+      update_server("rx timeout, async rpc");
+      moved = true;
+    }
+    if(moved) {
+      // Only requests still without a reply, including any that came in
+      // while looking for the leader
+      for(int i=0, seen=0;seen<async_cnt;i++) {
+	if(async[i].busy) {
+	  seen++;
+	  if(!async[i].replied) {
+	    async_send(&async[i], false);
+	  }
+	}
+      }
+    }
+    int done = 0;
+    for(int i=0;i<client_async_max && done < max && async_replied > 0;i++) {
+      async_rpc_t *a = &async[i];
+      if(a->busy && a->replied) {
+	completions[done].tag      = a->tag;
+	completions[done].response = a->response;
+	completions[done].size     = a->response_sz;
+	done++;
+	a->busy    = false;
+	a->replied = false;
+	async_cnt--;
+	async_replied--;
+      }
+    }
+    return done;
+  }
+
+  int remap(int partition, int core)
+  {
+    if(partition < 0 || partition >= map->partitions ||
+       core < 0 || core >= executor_threads) {
+      return -1;
+    }
+    while(map->core[partition] != core) {
+      remap_t req;
+      void *resp;
+      req.partition = partition;
+      req.core      = core;
+      core_mask_t mask = core_mask_single(map->core[partition]);
+      core_mask_set(&mask, core);
+      int resp_sz = call(RPC_REQ_REMAP, &req, sizeof(remap_t), &resp, mask, 0, -1);
+      adopt_map(resp, resp_sz);
+    }
+    return 0;
+  }
 } rpc_client_t;
 
 
@@ -255,6 +716,7 @@ void* cyclone_client_init(int client_id,
 			  int server_ports,
 			  const char *config_quorum)
 {
+  cyclone_config_init(config_quorum);
   rpc_client_t * client = new rpc_client_t();
   boost::property_tree::ptree pt_cluster;
   boost::property_tree::ptree pt_quorum;
@@ -265,6 +727,13 @@ void* cyclone_client_init(int client_id,
   client->me     = client_id;
   client->router = new quorum_switch(&pt_cluster, &pt_quorum);
   client->terms  = (unsigned int *)malloc(num_quorums*sizeof(unsigned int));
+  client->map    = (partition_map_t *)malloc(sizeof(partition_map_t));
+  memcpy(client->map, &partition_map, sizeof(partition_map_t));
+  client->map->version = 0; // Any map from the server wins
+  client->async     = NULL;
+  client->async_cnt = 0;
+  client->async_replied = 0;
+  memset(client->async_inflight, 0, sizeof(client->async_inflight));
   client->me_mc = client_mc;
   client->me_queue = client_queue;
   client->buf = (dpdk_rx_buffer_t *)malloc(sizeof(dpdk_rx_buffer_t));
@@ -280,6 +749,10 @@ void* cyclone_client_init(int client_id,
   buf = new char[MSG_MAXSIZE];
   client->packet_rep = (msg_t *)buf;
   client->replicas = pt_quorum.get<int>("quorum.replicas");
+  client->rtt = new rtt_estimator_t[client->replicas];
+  for(int i=0;i<client->replicas;i++) {
+    client->rtt[i].init();
+  }
   client->channel_seq = client_queue*client_mc*rtc_clock::current_time();
   for(int i=0;i<num_quorums;i++) {
     client->server = 0;
@@ -292,7 +765,7 @@ int make_rpc(void *handle,
 	     void *payload,
 	     int sz,
 	     void **response,
-	     unsigned long core_mask,
+	     core_mask_t core_mask,
 	     int flags)
 {
   rpc_client_t *client = (rpc_client_t *)handle;
@@ -305,14 +778,219 @@ int make_rpc(void *handle,
   return client->make_rpc(payload, sz, response, core_mask, flags);
 }
 
-int delete_node(void *handle, unsigned long core_mask, int node)
+int make_rpc_partition(void *handle,
+		       void *payload,
+		       int sz,
+		       void **response,
+		       int partition,
+		       int flags)
+{
+  rpc_client_t *client = (rpc_client_t *)handle;
+  if(sz > DISP_MAX_MSGSIZE) {
+    BOOST_LOG_TRIVIAL(fatal) << "rpc call params too large "
+			     << " param size =  " << sz
+			     << " DISP_MAX_MSGSIZE = " << DISP_MAX_MSGSIZE;
+    exit(-1);
+  }
+  if(partition < 0 || partition >= client->map->partitions) {
+    BOOST_LOG_TRIVIAL(fatal) << "Partition " << partition
+			     << " out of range, map has "
+			     << client->map->partitions;
+    exit(-1);
+  }
+  return client->call(RPC_REQ, 
+		      payload, 
+		      sz, 
+		      response, 
+		      core_mask_none(), 
+		      flags, 
+		      partition);
+}
+
+int make_rpc_async(void *handle,
+		   void *payload,
+		   int sz,
+		   core_mask_t core_mask,
+		   int flags,
+		   void *tag)
+{
+  rpc_client_t *client = (rpc_client_t *)handle;
+  if(sz > DISP_MAX_MSGSIZE) {
+    BOOST_LOG_TRIVIAL(fatal) << "rpc call params too large "
+			     << " param size =  " << sz
+			     << " DISP_MAX_MSGSIZE = " << DISP_MAX_MSGSIZE;
+    exit(-1);
+  }
+  return client->make_rpc_async(payload, sz, core_mask, flags, -1, tag);
+}
+
+int make_rpc_partition_async(void *handle,
+			     void *payload,
+			     int sz,
+			     int partition,
+			     int flags,
+			     void *tag)
+{
+  rpc_client_t *client = (rpc_client_t *)handle;
+  if(sz > DISP_MAX_MSGSIZE) {
+    BOOST_LOG_TRIVIAL(fatal) << "rpc call params too large "
+			     << " param size =  " << sz
+			     << " DISP_MAX_MSGSIZE = " << DISP_MAX_MSGSIZE;
+    exit(-1);
+  }
+  if(partition < 0 || partition >= client->map->partitions) {
+    BOOST_LOG_TRIVIAL(fatal) << "Partition " << partition
+			     << " out of range, map has "
+			     << client->map->partitions;
+    exit(-1);
+  }
+  return client->make_rpc_async(payload, 
+				sz, 
+				core_mask_none(), 
+				flags, 
+				partition, 
+				tag);
+}
+
+int cyclone_poll(void *handle, rpc_completion_t *completions, int max)
+{
+  rpc_client_t *client = (rpc_client_t *)handle;
+  return client->poll(completions, max);
+}
+
+int cyclone_partitions(void *handle)
+{
+  rpc_client_t *client = (rpc_client_t *)handle;
+  return client->map->partitions;
+}
+
+int cyclone_remap_partition(void *handle, int partition, int core)
+{
+  rpc_client_t *client = (rpc_client_t *)handle;
+  return client->remap(partition, core);
+}
+
+int cyclone_client_credits(void *handle)
+{
+  rpc_client_t *client = (rpc_client_t *)handle;
+  return client->window;
+}
+
+int delete_node(void *handle, core_mask_t core_mask, int node)
 {
   rpc_client_t *client = (rpc_client_t *)handle;
   return client->delete_node(core_mask, node);
 }
 
-int add_node(void *handle, unsigned long core_mask, int node)
+int add_node(void *handle, core_mask_t core_mask, int node)
 {
   rpc_client_t *client = (rpc_client_t *)handle;
   return client->add_node(core_mask, node);
 }
+
+typedef struct rpc_batch_st {
+  void *handle;
+  core_mask_t core_mask;
+  int partition;
+  int flags;
+  int ops;
+  int bytes;
+  unsigned long first_op; // usecs
+  char *payload;
+} rpc_batch_t;
+
+void* cyclone_batch_init(void *handle,
+			 core_mask_t core_mask,
+			 int partition,
+			 int flags)
+{
+  rpc_batch_t *batch = new rpc_batch_t();
+  batch->handle    = handle;
+  batch->core_mask = core_mask;
+  batch->partition = partition;
+  batch->flags     = flags | RPC_FLAG_BATCH;
+  batch->ops       = 0;
+  batch->bytes     = sizeof(int);
+  batch->payload   = new char[DISP_MAX_MSGSIZE];
+  return (void *)batch;
+}
+
+int cyclone_batch_add(void *handle, const void *op, int sz)
+{
+  rpc_batch_t *batch = (rpc_batch_t *)handle;
+  if(batch->ops == batch_max_ops ||
+     batch->bytes + sizeof(batch_op_t) + sz > DISP_MAX_MSGSIZE) {
+    if(batch->ops == 0) {
+      BOOST_LOG_TRIVIAL(fatal) << "batch op too large " 
+			       << " op size = " << sz;
+      exit(-1);
+    }
+    return -1;
+  }
+  if(batch->ops == 0) {
+    batch->first_op = rtc_clock::current_time();
+  }
+  char *ptr = batch->payload + batch->bytes;
+  ((batch_op_t *)ptr)->size = sz;
+  memcpy(ptr + sizeof(batch_op_t), op, sz);
+  batch->bytes += sizeof(batch_op_t) + sz;
+  return batch->ops++;
+}
+
+int cyclone_batch_due(void *handle)
+{
+  rpc_batch_t *batch = (rpc_batch_t *)handle;
+  return batch->ops == batch_max_ops ||
+    (batch->ops > 0 && 
+     rtc_clock::current_time() - batch->first_op >= batch_flush_usecs);
+}
+
+int cyclone_batch_flush(void *handle, rpc_batch_result_t *results)
+{
+  rpc_batch_t *batch = (rpc_batch_t *)handle;
+  if(batch->ops == 0) {
+    return 0;
+  }
+  *(int *)batch->payload = batch->ops;
+  unsigned char *resp;
+  int resp_sz;
+  if(batch->partition >= 0) {
+    resp_sz = make_rpc_partition(batch->handle,
+				 batch->payload,
+				 batch->bytes,
+				 (void **)&resp,
+				 batch->partition,
+				 batch->flags);
+  }
+  else {
+    resp_sz = make_rpc(batch->handle,
+		       batch->payload,
+		       batch->bytes,
+		       (void **)&resp,
+		       batch->core_mask,
+		       batch->flags);
+  }
+  batch->ops   = 0;
+  batch->bytes = sizeof(int);
+  if(resp_sz < (int)sizeof(int)) {
+    BOOST_LOG_TRIVIAL(fatal) << "Invalid batch response";
+    exit(-1);
+  }
+  int ops = *(int *)resp;
+  resp    += sizeof(int);
+  resp_sz -= sizeof(int);
+  for(int i=0;i<ops;i++) {
+    batch_result_hdr_t *hdr = (batch_result_hdr_t *)resp;
+    if(resp_sz < (int)sizeof(batch_result_hdr_t) ||
+       resp_sz < (int)sizeof(batch_result_hdr_t) + hdr->size) {
+      BOOST_LOG_TRIVIAL(fatal) << "Invalid batch response";
+      exit(-1);
+    }
+    results[i].code = hdr->code;
+    results[i].size = hdr->size;
+    results[i].data = resp + sizeof(batch_result_hdr_t);
+    resp    += sizeof(batch_result_hdr_t) + hdr->size;
+    resp_sz -= sizeof(batch_result_hdr_t) + hdr->size;
+  }
+  return ops;
+}
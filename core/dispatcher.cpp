@@ -17,13 +17,21 @@
 #include <boost/bind.hpp>
 #include<libpmemobj.h>
 #include "cyclone_context.hpp"
+#include "spin_wait.hpp"
 
 dpdk_context_t * global_dpdk_context = NULL;
 extern struct rte_ring ** to_cores;
+extern struct rte_ring ** to_anycore;
 extern struct rte_ring *from_cores;
 cyclone_t **quorums;
 core_status_t *core_status;
+volatile unsigned long partition_map_seq = 0;
+static PMEMobjpool *state;
+static disp_state_t *disp_state;
 static rpc_callbacks_t app_callbacks;
+static void **offload_logs = NULL;
+static bool ro_anycore = false;
+static struct rte_ring **to_logger;
 static void client_reply(rpc_t *req, 
 			 rpc_t *rep,
 			 void *payload,
@@ -33,8 +41,9 @@ static void client_reply(rpc_t *req,
   rte_mbuf *m = rte_pktmbuf_alloc(global_dpdk_context->mempools[q]);
   int port = queue2port(q, global_dpdk_context->ports);
   if(m == NULL) {
-    BOOST_LOG_TRIVIAL(fatal) << "Out of mbufs for client response";
-    exit(-1);
+    // Dropped, as on a lost packet the client times out and retries
+    BOOST_LOG_TRIVIAL(warning) << "Out of mbufs for client response";
+    return;
   }
   rep->channel_seq = req->channel_seq;
   if(sz > 0) {
@@ -56,6 +65,118 @@ static void client_reply(rpc_t *req,
   }
 }
 
+static int reply_queue(int core_id)
+{
+  return global_dpdk_context->ports + num_queues*num_quorums + core_id;
+}
+
+// Executor reply space outside the outgoing mbufs
+typedef struct reply_scratch_st {
+  // Results of the ops of a RPC_FLAG_BATCH request, gathered into the
+  // batch's reply afterwards
+  bool in_batch;
+  int arena_used;
+  char arena[DISP_MAX_MSGSIZE];
+  // Results that have no room above, and replies when the reply pool
+  // is exhausted (sent by copy, see client_reply_cookie)
+  char spare[MSG_MAXSIZE];
+} reply_scratch_t;
+static reply_scratch_t *reply_scratch;
+
+static void* reply_spare(rpc_cookie_t *cookie, int size)
+{
+  if(size > MSG_MAXSIZE) {
+    BOOST_LOG_TRIVIAL(fatal) << "Reply of " << size << " bytes too large";
+    exit(-1);
+  }
+  cookie->ret_value = reply_scratch[cookie->core_id].spare;
+  cookie->ret_size  = size;
+  return cookie->ret_value;
+}
+
+static bool is_reply_spare(rpc_cookie_t *cookie)
+{
+  return cookie->ret_value == reply_scratch[cookie->core_id].spare;
+}
+
+void* rpc_reply_buffer(rpc_cookie_t *cookie, int size)
+{
+  int offset = 
+    sizeof(struct ether_hdr) + 
+    sizeof(struct ipv4_hdr) + 
+    sizeof(rpc_t);
+  reply_scratch_t *rs = &reply_scratch[cookie->core_id];
+  if(rs->in_batch) {
+    if(rs->arena_used + size > DISP_MAX_MSGSIZE) {
+      return reply_spare(cookie, size);
+    }
+    cookie->ret_value = rs->arena + rs->arena_used;
+    cookie->ret_size  = size;
+    rs->arena_used   += size;
+    return cookie->ret_value;
+  }
+  rte_mbuf *m = (rte_mbuf *)cookie->reply_mbuf;
+  if(m == NULL) {
+    m = rte_pktmbuf_alloc(global_dpdk_context->mempools[reply_queue(cookie->core_id)]);
+    if(m == NULL) {
+      return reply_spare(cookie, size);
+    }
+    cookie->reply_mbuf = m;
+  }
+  if(offset + size > rte_pktmbuf_tailroom(m)) {
+    BOOST_LOG_TRIVIAL(fatal) << "Reply of " << size << " bytes too large";
+    exit(-1);
+  }
+  cookie->ret_value = rte_pktmbuf_mtod_offset(m, void *, offset);
+  cookie->ret_size  = size;
+  return cookie->ret_value;
+}
+
+// Drop a reply buffer that was not sent
+static void reply_release(rpc_cookie_t *cookie)
+{
+  if(cookie->reply_mbuf != NULL) {
+    rte_pktmbuf_free((rte_mbuf *)cookie->reply_mbuf);
+    cookie->reply_mbuf = NULL;
+  }
+}
+
+// Reply with cookie->ret_value, in place if it came from rpc_reply_buffer
+static void client_reply_cookie(rpc_t *req,
+				rpc_t *rep,
+				rpc_cookie_t *cookie,
+				int q)
+{
+  rte_mbuf *m = (rte_mbuf *)cookie->reply_mbuf;
+  rpc_t *hdr = NULL;
+  if(m != NULL) {
+    hdr = rte_pktmbuf_mtod_offset(m, 
+				  rpc_t *, 
+				  sizeof(struct ether_hdr) + 
+				  sizeof(struct ipv4_hdr));
+  }
+  if(hdr == NULL || cookie->ret_value != (void *)(hdr + 1)) {
+    client_reply(req, rep, cookie->ret_value, cookie->ret_size, q);
+    return;
+  }
+  cookie->reply_mbuf = NULL;
+  int port = queue2port(q, global_dpdk_context->ports);
+  rep->channel_seq = req->channel_seq;
+  memcpy(hdr, rep, sizeof(rpc_t));
+  cyclone_prep_mbuf_server2client_inplace(global_dpdk_context,
+					  port,
+					  req->requestor,
+					  req->client_port,
+					  m,
+					  sizeof(rpc_t) + cookie->ret_size);
+  int e = cyclone_tx(global_dpdk_context, 
+		     m, 
+		     q);
+  if(e) {
+    BOOST_LOG_TRIVIAL(warning) << "Failed to send response to client";
+  }
+}
+
 void init_rpc_cookie_info(rpc_cookie_t *cookie, 
 			  rpc_t *rpc,
 			  wal_entry_t *wal)
@@ -64,46 +185,236 @@ void init_rpc_cookie_info(rpc_cookie_t *cookie,
   cookie->ret_size    = 0;
   cookie->ret_value   = NULL;
   cookie->core_mask   = rpc->core_mask;
+  cookie->speculative = 0;
+  cookie->single_exec = 0;
+  cookie->ret_code    = 0;
+}
+
+// Executor scratch space for RPC_FLAG_BATCH requests
+typedef struct batch_scratch_st {
+  const unsigned char *data[batch_max_ops];
+  int len[batch_max_ops];
+  int ret_size[batch_max_ops]; // As it fits the reply
+  rpc_cookie_t cookies[batch_max_ops];
+} batch_scratch_t;
+static batch_scratch_t *batch_scratch;
+
+// Run each op of a batch with its own cookie and gather their results
+// into the batch's reply
+static void exec_batch(rpc_t *rpc,
+		       const unsigned char *payload,
+		       int len,
+		       rpc_cookie_t *cookie)
+{
+  batch_scratch_t *b = &batch_scratch[cookie->core_id];
+  int ops = batch_split(payload, len, b->data, b->len);
+  if(ops < 0) {
+    BOOST_LOG_TRIVIAL(warning) << "Dropping malformed batch";
+    ops = 0;
+  }
+  for(int i=0;i<ops;i++) {
+    b->cookies[i]            = *cookie;
+    b->cookies[i].ret_value  = NULL;
+    b->cookies[i].ret_size   = 0;
+    b->cookies[i].reply_mbuf = NULL;
+    b->cookies[i].ret_code   = 0;
+  }
+  reply_scratch_t *rs = &reply_scratch[cookie->core_id];
+  rs->in_batch   = true;
+  rs->arena_used = 0;
+  bool applied = true;
+  if(rpc->flags & RPC_FLAG_BATCH_ATOMIC) {
+    if(app_callbacks.rpc_batch_callback != NULL) {
+      app_callbacks.rpc_batch_callback(b->data, b->len, b->cookies, ops);
+    }
+    else {
+      // Cannot apply them as a unit, apply none
+      for(int i=0;i<ops;i++) {
+	b->cookies[i].ret_code = BATCH_OP_NOT_ATOMIC;
+      }
+      applied = false;
+    }
+  }
+  else {
+    for(int i=0;i<ops;i++) {
+      app_callbacks.rpc_callback(b->data[i], b->len[i], &b->cookies[i]);
+    }
+  }
+  rs->in_batch = false;
+  int room = DISP_MAX_MSGSIZE - sizeof(int) - ops*sizeof(batch_result_hdr_t);
+  int size = DISP_MAX_MSGSIZE - room;
+  for(int i=0;i<ops;i++) {
+    b->ret_size[i] = b->cookies[i].ret_size;
+    // Spare is shared by every op that overflowed the arena
+    if(b->ret_size[i] > room || is_reply_spare(&b->cookies[i])) {
+      b->ret_size[i] = -1;
+      continue;
+    }
+    room -= b->ret_size[i];
+    size += b->ret_size[i];
+  }
+  unsigned char *reply = (unsigned char *)rpc_reply_buffer(cookie, size);
+  *(int *)reply = ops;
+  reply += sizeof(int);
+  for(int i=0;i<ops;i++) {
+    batch_result_hdr_t *hdr = (batch_result_hdr_t *)reply;
+    reply += sizeof(batch_result_hdr_t);
+    if(b->ret_size[i] == -1) {
+      hdr->code = BATCH_OP_TRUNCATED;
+      hdr->size = 0;
+    }
+    else {
+      hdr->code = b->cookies[i].ret_code;
+      hdr->size = b->ret_size[i];
+      memcpy(reply, b->cookies[i].ret_value, b->ret_size[i]);
+      reply += b->ret_size[i];
+    }
+    if(applied && app_callbacks.gc_callback != NULL) {
+      app_callbacks.gc_callback(&b->cookies[i]);
+    }
+  }
+}
+
+static void app_rpc(rpc_t *rpc,
+		    const unsigned char *data,
+		    int len,
+		    rpc_cookie_t *cookie)
+{
+  if(rpc->flags & RPC_FLAG_BATCH) {
+    exec_batch(rpc, data, len, cookie);
+  }
+  else {
+    app_callbacks.rpc_callback(data, len, cookie);
+  }
+}
+
+static int is_single_exec_rpc(rpc_t *rpc)
+{
+  return is_multicore_rpc(rpc) && (rpc->flags & RPC_FLAG_SINGLE_EXEC);
 }
 
 static int do_multicore_redezvous(rpc_cookie_t *cookie,
 				  rpc_t *rpc, 
 				  wal_entry_t *wal)
 {
-  unsigned long mask     = rpc->core_mask;
-  unsigned int *snapshot = (unsigned int *)(rpc + 1);
-  int core_leader = __builtin_ffsl(mask) - 1;
-  core_status_t *cstatus_leader = &core_status[core_leader];
-  if(cookie->core_id == core_leader) {
-    if(!wait_barrier_leader(cstatus_leader, 
-			    rpc2rdv(rpc),
-			    cookie->core_id,
-			    snapshot,
-			    mask)) {
-      return 0;
+  return wait_barrier(rpc2rdv(rpc),
+		      cookie->core_id,
+		      (unsigned int *)(rpc + 1),
+		      rpc->core_mask);
+}
+
+// Partition fence left by a RPC_FLAG_SINGLE_EXEC request run by another
+// core: requests for the fenced partition are parked until that core
+// releases it, the rest keep running
+typedef struct exec_fence_st {
+  unsigned long tag; // Request nonce, 0 if none
+  int leader;
+  unsigned int leader_term;
+  int partition; // Logical partition, -1 for all of this core's
+} exec_fence_t;
+
+static void single_exec_release(rpc_t *rpc)
+{
+  unsigned long tag = rpc2rdv(rpc)->rtc_ts;
+  core_mask_t mask  = rpc->core_mask;
+  int leader        = core_mask_first(mask);
+  for_each_core(c, mask) {
+    // Cores that failed never arrived, their slot may be in use again
+    if(c != leader && core_status[c].arrive.tag == tag) {
+      core_status[c].release.tag = tag;
     }
   }
-  else {
-    if(!wait_barrier_follower(cstatus_leader, 
-			      rpc2rdv(rpc),
-			      cookie->core_id,
-			      snapshot[core_to_quorum(core_leader)],
-			      mask)) {
-      return 0;
+}
+
+// RPC_FLAG_SINGLE_EXEC: every other core publishes that its partition
+// reached the request in log order and sets a fence, the lowest core
+// waits for all of them. Returns 0 if the request fails, else sets
+// *run on the core that is to execute it.
+static int single_exec_enter(rpc_cookie_t *cookie,
+			     rpc_t *rpc,
+			     exec_fence_t *fence,
+			     int *run)
+{
+  unsigned long tag      = rpc2rdv(rpc)->rtc_ts;
+  unsigned int *snapshot = (unsigned int *)(rpc + 1);
+  core_mask_t mask       = rpc->core_mask;
+  int leader             = core_mask_first(mask);
+  core_status_t *cstatus = &core_status[cookie->core_id];
+  *run = 0;
+  if(core_term_failed(snapshot, cookie->core_id)) {
+    return 0; // The leader counts it as failed
+  }
+  if(cookie->core_id != leader) {
+    cstatus->arrive.ok = 1;
+    __sync_synchronize();
+    cstatus->arrive.tag = tag;
+    fence->tag         = tag;
+    fence->leader      = leader;
+    fence->leader_term = snapshot[core_to_quorum(leader)];
+    fence->partition   = -1;
+    return 1;
+  }
+  int ok = 1;
+  for_each_core(c, mask) {
+    if(c == leader) {
+      continue;
+    }
+    spin_wait_t w;
+    spin_wait_init(&w);
+    while(core_status[c].arrive.tag != tag) {
+      if(core_term_failed(snapshot, c)) {
+	ok = 0;
+	break;
+      }
+      barrier_wait_step(&w, &core_status[c].arrive);
     }
   }
+  if(!ok) {
+    single_exec_release(rpc);
+    return 0;
+  }
+  cookie->single_exec = 1;
+  *run = 1;
   return 1;
 }
 
+// Hand a record to the flash log lcore as one executor descriptor, it
+// finds the size in the rpc and the raft idx in the wal entry, and
+// drops the mbuf reference
+static void offload_flashlog(int core, rte_mbuf *m, rpc_t *rpc)
+{
+  rte_pktmbuf_refcnt_update(m, 1);
+  void *desc = exec_desc_encode(0, m, rpc);
+  while(rte_ring_sp_enqueue(to_logger[core], desc) == -ENOBUFS);
+}
+
+// Log a committed request, returns the checkpointed log idx
+// (unused in offload mode)
+static int flashlog_rpc(rpc_t *rpc,
+			wal_entry_t *wal,
+			int len,
+			rpc_cookie_t *cookie,
+			rte_mbuf *m)
+{
+  if(offload_logs != NULL) {
+    offload_flashlog(cookie->core_id, m, rpc);
+    return -1;
+  }
+  return app_callbacks.flashlog_callback
+    ((const unsigned char *)rpc, len + sizeof(rpc_t), cookie);
+}
+
 int exec_rpc_internal(rpc_t *rpc, 
 		      wal_entry_t *wal,
 		      int len, 
 		      rpc_cookie_t *cookie, 
-		      core_status_t *cstatus)
+		      core_status_t *cstatus,
+		      rte_mbuf *m,
+		      exec_fence_t *fence)
 {
   
   init_rpc_cookie_info(cookie, rpc, wal);
-  while(wal->rep == REP_UNKNOWN);
+  spin_wait_while(&wal->rep, REP_UNKNOWN);
   if(wal->rep != REP_SUCCESS) {    
     return -1;
   } 
@@ -111,34 +422,51 @@ int exec_rpc_internal(rpc_t *rpc,
      cstatus->exec_term < wal->term) {
     cstatus->exec_term = wal->term;
   }
-  if(is_multicore_rpc(rpc)) {
+  int run = 1;
+  if(is_single_exec_rpc(rpc)) {
+    if(!single_exec_enter(cookie, rpc, fence, &run)) {
+      return -1;
+    }
+  }
+  else if(is_multicore_rpc(rpc)) {
     if(!do_multicore_redezvous(cookie, rpc, wal)) {
       return -1;
     }
   }
 
   const unsigned char * user_data = (const unsigned char *)(rpc + 1);
-  int checkpoint_idx = app_callbacks.flashlog_callback
-    ((const unsigned char *)rpc, len + sizeof(rpc_t), cookie);
+  int checkpoint_idx = flashlog_rpc(rpc, wal, len, cookie, m);
   if(is_multicore_rpc(rpc)) {
     user_data += num_quorums*sizeof(unsigned int) + sizeof(ic_rdv_t);
     len        -= (num_quorums*sizeof(unsigned int) + sizeof(ic_rdv_t));
   }
-  app_callbacks.rpc_callback(user_data,
-			     len,
-			     cookie);
-  cstatus->checkpoint_idx = checkpoint_idx;
-  __sync_synchronize(); // publish core status
-  return 0;
+  if(run) {
+    app_rpc(rpc, user_data, len, cookie);
+    if(cookie->single_exec) {
+      single_exec_release(rpc);
+    }
+  }
+  if(offload_logs == NULL) {
+    cstatus->checkpoint_idx = checkpoint_idx;
+    __sync_synchronize(); // publish core status
+  }
+  return run ? 0 : -1;
 }
 
 int exec_rpc_internal_ro(rpc_t *rpc, 
 			 wal_entry_t *wal,
 			 int len, 
-			 rpc_cookie_t *cookie)
+			 rpc_cookie_t *cookie,
+			 exec_fence_t *fence)
 {
   init_rpc_cookie_info(cookie, rpc, wal);
-  if(is_multicore_rpc(rpc)) {
+  if(is_single_exec_rpc(rpc)) {
+    int run;
+    if(!single_exec_enter(cookie, rpc, fence, &run) || !run) {
+      return -1;
+    }
+  }
+  else if(is_multicore_rpc(rpc)) {
     if(!do_multicore_redezvous(cookie, rpc, wal)) {
       return -1;
     }
@@ -148,9 +476,65 @@ int exec_rpc_internal_ro(rpc_t *rpc,
     user_data += num_quorums*sizeof(unsigned int) + sizeof(ic_rdv_t);
     len       -= (num_quorums*sizeof(unsigned int) + sizeof(ic_rdv_t));
   }
-  app_callbacks.rpc_callback(user_data,
-			     len,
-			     cookie);
+  app_rpc(rpc, user_data, len, cookie);
+  if(cookie->single_exec) {
+    single_exec_release(rpc);
+  }
+  return 0;
+}
+
+// Keep a move in the dispatcher state for restarts, the entry before
+// the version so a torn update is only ever an older version
+static void partition_map_persist(int partition)
+{
+  partition_map_t *saved = &disp_state->partition_map;
+  saved->core[partition] = partition_map.core[partition];
+  pmemobj_persist(state, &saved->core[partition], 1);
+  saved->version = partition_map.version;
+  pmemobj_persist(state, &saved->version, sizeof(saved->version));
+}
+
+// RPC_REQ_REMAP runs like a RPC_FLAG_SINGLE_EXEC request on the old and
+// new core: both reach it in log order, then the lowest moves the
+// partition while the other is fenced. Every move of a partition
+// involves its owner, so moves are ordered by the owner's log.
+int exec_remap_internal(rpc_t *rpc,
+			wal_entry_t *wal,
+			rpc_cookie_t *cookie,
+			core_status_t *cstatus,
+			exec_fence_t *fence)
+{
+  init_rpc_cookie_info(cookie, rpc, wal);
+  spin_wait_while(&wal->rep, REP_UNKNOWN);
+  if(wal->rep != REP_SUCCESS) {
+    return -1;
+  }
+  if(cstatus->exec_term < wal->term) {
+    cstatus->exec_term = wal->term;
+  }
+  remap_t *remap = (remap_t *)(((char *)(rpc + 1)) + 
+			       num_quorums*sizeof(unsigned int) + 
+			       sizeof(ic_rdv_t));
+  int run;
+  if(!single_exec_enter(cookie, rpc, fence, &run)) {
+    return -1;
+  }
+  if(!run) {
+    fence->partition = remap->partition; // Only the moving one waits
+    return -1;
+  }
+  partition_map_write_lock();
+  if(remap->partition >= 0 &&
+     remap->partition < partition_map.partitions &&
+     core_mask_test(rpc->core_mask, 
+		    partition_map.core[remap->partition]) &&
+     core_mask_test(rpc->core_mask, remap->core)) {
+    partition_map.core[remap->partition] = remap->core;
+    partition_map.version++;
+    partition_map_persist(remap->partition);
+  }
+  partition_map_write_unlock();
+  single_exec_release(rpc);
   return 0;
 }
 
@@ -166,6 +550,41 @@ typedef struct executor_st {
   core_status_t *cstatus;
   int replicas;
   unsigned long QUORUM_TO;
+  unsigned long POLL_TO;
+
+  // Pending requests for rpc_batch_callback, in log order
+  int batch_cnt;
+  rte_mbuf *batch_m[executor_burst];
+  rpc_t *batch_rpc[executor_burst];
+  wal_entry_t *batch_wal[executor_burst];
+  int batch_quorum[executor_burst];
+  const unsigned char *batch_data[executor_burst];
+  int batch_len[executor_burst];
+  rpc_cookie_t batch_cookies[executor_burst];
+  int batch_checkpoint_idx;
+  unsigned long batch_calls;
+  unsigned long batch_reqs;
+
+  // Speculatively executed requests awaiting commit, in log order
+  bool speculate;
+  int spec_head;
+  int spec_cnt;
+  rte_mbuf *spec_m[executor_spec_max];
+  rpc_t *spec_rpc[executor_spec_max];
+  wal_entry_t *spec_wal[executor_spec_max];
+  int spec_quorum[executor_spec_max];
+  rpc_cookie_t spec_cookies[executor_spec_max];
+
+  exec_fence_t fence;
+  // Descriptors held behind the fence, in ring order
+  int park_head;
+  int park_cnt;
+  void *parked[executor_park_max];
+
+  // Requests whose mbuf lives on another socket's mempool
+  int socket;
+  unsigned long descs_seen;
+  unsigned long descs_remote;
 
   int compute_quorum_size(int idx)
   {
@@ -192,7 +611,7 @@ typedef struct executor_st {
   {
     cookie.core_id   = tid;
     if(client_buffer->code == RPC_REQ_KICKER) {
-      while(wal->rep == REP_UNKNOWN);
+      spin_wait_while(&wal->rep, REP_UNKNOWN);
       if(wal->rep == REP_SUCCESS && 
 	 cstatus->exec_term < wal->term) {
 	cstatus->exec_term = wal->term;
@@ -202,7 +621,10 @@ typedef struct executor_st {
     else if(client_buffer->code == RPC_REQ_STABLE) {
       resp_buffer->code = RPC_REP_OK;
       cookie.ret_value  = client_buffer + 1;
-      cookie.ret_size   = num_quorums*sizeof(unsigned int);
+      cookie.ret_size   = 
+	num_quorums*sizeof(unsigned int) + 
+	sizeof(int) + 
+	partition_map_size(&partition_map);
       client_reply(client_buffer, 
 		   resp_buffer, 
 		   cookie.ret_value, 
@@ -210,26 +632,45 @@ typedef struct executor_st {
 		   global_dpdk_context->ports + num_queues*num_quorums + tid);
     }
     else if(client_buffer->flags & RPC_FLAG_RO) {
-      int e = exec_rpc_internal_ro(client_buffer, wal, sz, &cookie);
-      int response_core = __builtin_ffsl(client_buffer->core_mask) - 1;
+      int e = exec_rpc_internal_ro(client_buffer, wal, sz, &cookie, &fence);
+      int response_core = core_mask_first(client_buffer->core_mask);
+      if((client_buffer->flags & RPC_FLAG_ANYCORE) && 
+	 !is_multicore_rpc(client_buffer)) {
+	response_core = tid; // Whoever took it from the shared ring
+      }
       if(response_core == tid && 
 	 wal->leader && 
 	 !e && 
 	 (quorums[quorum]->snapshot&1)) {
 	resp_buffer->code = RPC_REP_OK;
-	client_reply(client_buffer, 
-		     resp_buffer, 
-		     cookie.ret_value, 
-		     cookie.ret_size,
-		     global_dpdk_context->ports +num_queues*num_quorums + tid);
+	client_reply_cookie(client_buffer, 
+			    resp_buffer, 
+			    &cookie,
+			    reply_queue(tid));
       }
-      if(!e) {
+      if(!e && app_callbacks.gc_callback != NULL) {
 	app_callbacks.gc_callback(&cookie);
       }
+      reply_release(&cookie);
+    }
+    else if(client_buffer->code == RPC_REQ_REMAP) {
+      int e = exec_remap_internal(client_buffer, wal, &cookie, cstatus, &fence);
+      if(!e && 
+	 wal->leader &&
+	 (quorums[quorum]->snapshot&1)) {
+	partition_map_t map;
+	partition_map_copy(&map);
+	resp_buffer->code = RPC_REP_OK;
+	client_reply(client_buffer,
+		     resp_buffer,
+		     &map,
+		     partition_map_size(&map),
+		     reply_queue(tid));
+      }
     }
     else if(client_buffer->code == RPC_REQ_NODEDEL || 
 	    client_buffer->code == RPC_REQ_NODEADD) {
-      while(wal->rep == REP_UNKNOWN);
+      spin_wait_while(&wal->rep, REP_UNKNOWN);
       if(wal->rep == REP_SUCCESS && 
 	 cstatus->exec_term < wal->term) {
 	cstatus->exec_term = wal->term;
@@ -246,51 +687,521 @@ typedef struct executor_st {
       }
     }
     else {
-      int e = exec_rpc_internal(client_buffer, wal, sz, &cookie, cstatus);
-      int response_core = __builtin_ffsl(client_buffer->core_mask) - 1;
+      int e = exec_rpc_internal(client_buffer, wal, sz, &cookie, cstatus, m,
+				&fence);
+      int response_core = core_mask_first(client_buffer->core_mask);
       if(response_core == tid &&
 	 wal->leader && 
 	 !e && 
 	 (quorums[quorum]->snapshot&1)) {
 	await_quorum(client_buffer, wal->idx);
 	resp_buffer->code = RPC_REP_OK;
-	client_reply(client_buffer, 
-		     resp_buffer, 
-		     cookie.ret_value, 
-		     cookie.ret_size,
-		     global_dpdk_context->ports +num_queues*num_quorums + tid);
+	client_reply_cookie(client_buffer, 
+			    resp_buffer, 
+			    &cookie,
+			    reply_queue(tid));
       }
-      if(!e) {
+      if(!e && app_callbacks.gc_callback != NULL) {
 	app_callbacks.gc_callback(&cookie);
       }
+      reply_release(&cookie);
     }
   }
 
+  void finish(rte_mbuf *mbuf, int q, rpc_t *rpc)
+  {
+    if(!is_multicore_rpc(rpc)) {
+      quorums[q]->remove_inflight(rpc->client_id);
+      quorums[q]->forget(rpc);
+    }
+    else if(tid == core_mask_first(rpc->core_mask)){
+      quorums[0]->remove_inflight(rpc->client_id);
+      quorums[0]->forget(rpc);
+    }
+    rte_pktmbuf_free(mbuf);
+  }
+
+  bool batchable(rpc_t *rpc)
+  {
+    return app_callbacks.rpc_batch_callback != NULL &&
+      !speculate &&
+      rpc->code == RPC_REQ &&
+      !(rpc->flags & (RPC_FLAG_RO|RPC_FLAG_BATCH)) &&
+      !is_multicore_rpc(rpc);
+  }
+
+  bool speculable(rpc_t *rpc)
+  {
+    return speculate &&
+      rpc->code == RPC_REQ &&
+      !(rpc->flags & (RPC_FLAG_RO|RPC_FLAG_BATCH)) &&
+      !is_multicore_rpc(rpc);
+  }
+
+  // Execute before commit, the reply waits in the cookie
+  void spec_add(rte_mbuf *mbuf, int q, rpc_t *rpc)
+  {
+    if(spec_cnt == executor_spec_max) {
+      spec_resolve(true);
+    }
+    int slot = (spec_head + spec_cnt) % executor_spec_max;
+    wal_entry_t *w = pktadj2wal(mbuf);
+    rpc_cookie_t *c = &spec_cookies[slot];
+    c->core_id    = tid;
+    c->reply_mbuf = NULL;
+    init_rpc_cookie_info(c, rpc, w);
+    c->speculative = 1;
+    if(w->rep == REP_FAILED) {
+      finish(mbuf, q, rpc);
+      return;
+    }
+    app_callbacks.rpc_callback((const unsigned char *)(rpc + 1),
+			       rpc->payload_sz,
+			       c);
+    spec_m[slot]      = mbuf;
+    spec_rpc[slot]    = rpc;
+    spec_wal[slot]    = w;
+    spec_quorum[slot] = q;
+    spec_cnt++;
+  }
+
+  // Commit or abort speculative requests from the head, waiting for
+  // the head (and so all of them) to resolve if wait is set
+  void spec_resolve(bool wait)
+  {
+    while(spec_cnt > 0) {
+      int slot = spec_head;
+      wal_entry_t *w = spec_wal[slot];
+      if(w->rep == REP_UNKNOWN) {
+	if(!wait) {
+	  return;
+	}
+	spin_wait_while(&w->rep, REP_UNKNOWN);
+      }
+      if(w->rep != REP_SUCCESS) {
+	spec_rollback();
+	continue;
+      }
+      rpc_cookie_t *c = &spec_cookies[slot];
+      rpc_t *rpc      = spec_rpc[slot];
+      if(cstatus->exec_term < w->term) {
+	cstatus->exec_term = w->term;
+      }
+      int checkpoint_idx = flashlog_rpc(rpc, w, rpc->payload_sz, c, spec_m[slot]);
+      app_callbacks.spec_commit_callback(c);
+      if(offload_logs == NULL) {
+	cstatus->checkpoint_idx = checkpoint_idx;
+	__sync_synchronize(); // publish core status
+      }
+      if(w->leader && (quorums[spec_quorum[slot]]->snapshot&1)) {
+	resp_buffer->code = RPC_REP_OK;
+	client_reply_cookie(rpc,
+			    resp_buffer,
+			    c,
+			    reply_queue(tid));
+      }
+      if(app_callbacks.gc_callback != NULL) {
+	app_callbacks.gc_callback(c);
+      }
+      reply_release(c);
+      finish(spec_m[slot], spec_quorum[slot], rpc);
+      spec_head = (spec_head + 1) % executor_spec_max;
+      spec_cnt--;
+    }
+  }
+
+  // Entries are dropped from the log tail first, so once the head has
+  // failed so has every request queued before the drop. Undo everything
+  // newest first then redo the requests appended since.
+  void spec_rollback()
+  {
+    for(int i=spec_cnt-1;i>=0;i--) {
+      int slot = (spec_head + i) % executor_spec_max;
+      app_callbacks.spec_abort_callback(&spec_cookies[slot]);
+      if(app_callbacks.gc_callback != NULL) {
+	app_callbacks.gc_callback(&spec_cookies[slot]);
+      }
+      reply_release(&spec_cookies[slot]);
+    }
+    int cnt = spec_cnt;
+    int kept = 0;
+    for(int i=0;i<cnt;i++) {
+      int slot = (spec_head + i) % executor_spec_max;
+      if(spec_wal[slot]->rep == REP_FAILED) {
+	finish(spec_m[slot], spec_quorum[slot], spec_rpc[slot]);
+	continue;
+      }
+      int to = (spec_head + kept) % executor_spec_max;
+      spec_m[to]      = spec_m[slot];
+      spec_rpc[to]    = spec_rpc[slot];
+      spec_wal[to]    = spec_wal[slot];
+      spec_quorum[to] = spec_quorum[slot];
+      rpc_cookie_t *c = &spec_cookies[to];
+      c->core_id    = tid;
+      c->reply_mbuf = NULL;
+      init_rpc_cookie_info(c, spec_rpc[to], spec_wal[to]);
+      c->speculative = 1;
+      app_callbacks.rpc_callback((const unsigned char *)(spec_rpc[to] + 1),
+				 spec_rpc[to]->payload_sz,
+				 c);
+      kept++;
+    }
+    spec_cnt = kept;
+  }
+
+  // Wait for commit and log the request, then queue it for the batch
+  void batch_add(rte_mbuf *mbuf, int q, rpc_t *rpc)
+  {
+    wal_entry_t *w = pktadj2wal(mbuf);
+    rpc_cookie_t *c = &batch_cookies[batch_cnt];
+    c->core_id    = tid;
+    c->reply_mbuf = NULL;
+    init_rpc_cookie_info(c, rpc, w);
+    spin_wait_while(&w->rep, REP_UNKNOWN);
+    if(w->rep != REP_SUCCESS) {
+      finish(mbuf, q, rpc);
+      return;
+    }
+    if(cstatus->exec_term < w->term) {
+      cstatus->exec_term = w->term;
+    }
+    batch_checkpoint_idx = flashlog_rpc(rpc, w, rpc->payload_sz, c, mbuf);
+    batch_m[batch_cnt]      = mbuf;
+    batch_rpc[batch_cnt]    = rpc;
+    batch_wal[batch_cnt]    = w;
+    batch_quorum[batch_cnt] = q;
+    batch_data[batch_cnt]   = (const unsigned char *)(rpc + 1);
+    batch_len[batch_cnt]    = rpc->payload_sz;
+    batch_cnt++;
+  }
+
+  void batch_flush()
+  {
+    if(batch_cnt == 0) {
+      return;
+    }
+    app_callbacks.rpc_batch_callback(batch_data,
+				     batch_len,
+				     batch_cookies,
+				     batch_cnt);
+    if(offload_logs == NULL) {
+      cstatus->checkpoint_idx = batch_checkpoint_idx;
+      __sync_synchronize(); // publish core status
+    }
+    for(int i=0;i<batch_cnt;i++) {
+      if(batch_wal[i]->leader && (quorums[batch_quorum[i]]->snapshot&1)) {
+	await_quorum(batch_rpc[i], batch_wal[i]->idx);
+	resp_buffer->code = RPC_REP_OK;
+	client_reply_cookie(batch_rpc[i],
+			    resp_buffer,
+			    &batch_cookies[i],
+			    reply_queue(tid));
+      }
+      if(app_callbacks.gc_callback != NULL) {
+	app_callbacks.gc_callback(&batch_cookies[i]);
+      }
+      reply_release(&batch_cookies[i]);
+      finish(batch_m[i], batch_quorum[i], batch_rpc[i]);
+    }
+    batch_calls++;
+    batch_reqs += batch_cnt;
+    batch_cnt = 0;
+    if(batch_reqs >= executor_batch_report) {
+      BOOST_LOG_TRIVIAL(info) << "Executor " << tid
+			      << " mean batch size = "
+			      << ((double)batch_reqs)/batch_calls;
+      batch_calls = 0;
+      batch_reqs  = 0;
+    }
+  }
+
+  bool awaits_commit(rpc_t *rpc)
+  {
+    return rpc->code != RPC_REQ_STABLE && !(rpc->flags & RPC_FLAG_RO);
+  }
+
+  // The core running the single exec request released this partition,
+  // or its quorum moved on
+  bool fence_released()
+  {
+    return cstatus->release.tag == fence.tag ||
+      fence.leader_term < core_status[fence.leader].exec_term;
+  }
+
+  // Only ever waited on with the park full
+  void fence_wait()
+  {
+    spin_wait_t w;
+    spin_wait_init(&w);
+    while(!fence_released()) {
+      barrier_wait_step(&w, &cstatus->release);
+    }
+  }
+
+  // Touches what the fence holds: on a whole core fence anything but
+  // reads anycore of partitions owned elsewhere, on a partition fence
+  // anything that is not a plain request for another partition
+  bool fenced(rpc_t *rpc)
+  {
+    bool other = rpc->code == RPC_REQ &&
+      !is_multicore_rpc(rpc) &&
+      rpc->partition >= 0 &&
+      rpc->partition < partition_map.partitions;
+    if(fence.partition < 0) {
+      return !(other &&
+	       (rpc->flags & RPC_FLAG_RO) &&
+	       (rpc->flags & RPC_FLAG_ANYCORE) &&
+	       partition_map_owner(rpc->partition) != tid);
+    }
+    return !(other && rpc->partition != fence.partition);
+  }
+
+  // Once the fence is released run what it held, in order. A parked
+  // request may fence again, the rest then stays parked.
+  void unpark()
+  {
+    if(fence.tag == 0 || !fence_released()) {
+      return;
+    }
+    fence.tag = 0;
+    while(park_cnt > 0 && fence.tag == 0) {
+      void *desc = parked[park_head];
+      park_head = (park_head + 1) % executor_park_max;
+      park_cnt--;
+      run_now(desc);
+    }
+  }
+
+  void count_remote(rte_mbuf *mbuf)
+  {
+    descs_seen++;
+    if(mbuf->pool->socket_id != socket) {
+      descs_remote++;
+    }
+    if(descs_seen >= executor_batch_report) {
+      if(descs_remote > 0) {
+	BOOST_LOG_TRIVIAL(info) << "Executor " << tid
+				<< " remote socket mbufs = "
+				<< (100.0*descs_remote)/descs_seen << "%";
+      }
+      descs_seen   = 0;
+      descs_remote = 0;
+    }
+  }
+
+  // Routed by a partition map older than this core's log position
+  bool partition_moved(rpc_t *rpc)
+  {
+    if(rpc->code != RPC_REQ || 
+       rpc->partition < 0 || 
+       is_multicore_rpc(rpc)) {
+      return false;
+    }
+    if(rpc->partition >= partition_map.partitions) {
+      return true;
+    }
+    int owner = partition_map_owner(rpc->partition);
+    if((rpc->flags & RPC_FLAG_RO) && (rpc->flags & RPC_FLAG_ANYCORE)) {
+      return core_to_quorum(owner) != core_to_quorum(tid);
+    }
+    return owner != tid;
+  }
+
+  // Send the current map back, the client retries with it
+  void reject_moved(rte_mbuf *mbuf, int q, rpc_t *rpc)
+  {
+    if(pktadj2wal(mbuf)->leader && (quorums[q]->snapshot&1)) {
+      partition_map_t map;
+      partition_map_copy(&map);
+      resp_buffer->code = RPC_REP_REMAP;
+      client_reply(rpc,
+		   resp_buffer,
+		   &map,
+		   partition_map_size(&map),
+		   reply_queue(tid));
+    }
+    finish(mbuf, q, rpc);
+  }
+
+  // Execute a handed off request, or park it behind the fence
+  void run(void *desc)
+  {
+    unpark();
+    int q;
+    rpc_t *rpc;
+    exec_desc_decode(desc, &q, &rpc);
+    while(fence.tag != 0 && fenced(rpc)) {
+      if(park_cnt < executor_park_max) {
+	parked[(park_head + park_cnt) % executor_park_max] = desc;
+	park_cnt++;
+	return;
+      }
+      fence_wait();
+      unpark();
+    }
+    run_now(desc);
+  }
+
+  void run_now(void *desc)
+  {
+    int q;
+    m = exec_desc_decode(desc, &q, &client_buffer);
+    if(partition_moved(client_buffer)) {
+      reject_moved(m, q, client_buffer);
+      return;
+    }
+    if(speculable(client_buffer)) {
+      spec_add(m, q, client_buffer);
+      return;
+    }
+    spec_resolve(true);
+    if(batchable(client_buffer)) {
+      batch_add(m, q, client_buffer);
+      return;
+    }
+    batch_flush();
+    quorum = q;
+    sz = client_buffer->payload_sz;
+    //client_buffer->timestamp = rte_get_tsc_cycles();
+    wal = pktadj2wal(m);
+    exec();
+    finish(m, quorum, client_buffer);
+  }
+
+  // Run single core RO requests from descs[from, cnt) ahead of an
+  // uncommitted entry, they are not ordered against the log. Multicore
+  // ones keep their place as other cores rendezvous in ring order.
+  void run_ready_ro(void **descs, int from, int cnt)
+  {
+    for(int i=from;i<cnt;i++) {
+      if(descs[i] == NULL) {
+	continue;
+      }
+      int q;
+      rpc_t *rpc;
+      exec_desc_decode(descs[i], &q, &rpc);
+      if(rpc->code == RPC_REQ &&
+	 (rpc->flags & RPC_FLAG_RO) &&
+	 !is_multicore_rpc(rpc)) {
+	run(descs[i]);
+	descs[i] = NULL;
+      }
+    }
+  }
+
+  void poll_flashlog()
+  {
+    cookie.core_id = tid;
+    core_status[tid].checkpoint_idx = 
+      app_callbacks.flashlog_poll_callback(&cookie);
+    __sync_synchronize(); // publish core status
+  }
+
   void operator() ()
   {
     resp_buffer = (rpc_t *)malloc(MSG_MAXSIZE);
+    unsigned long next_poll = 0;
+    bool poll = (app_callbacks.flashlog_poll_callback != NULL &&
+		 offload_logs == NULL);
+    void *descs[executor_burst];
+    batch_cnt   = 0;
+    batch_calls = 0;
+    batch_reqs  = 0;
+    cstatus     = &core_status[tid];
+    cookie.reply_mbuf = NULL;
+    speculate = (app_callbacks.spec_commit_callback != NULL &&
+		 app_callbacks.spec_abort_callback != NULL);
+    spec_head = 0;
+    spec_cnt  = 0;
+    fence.tag = 0;
+    park_head = 0;
+    park_cnt  = 0;
+    socket       = rte_socket_id();
+    descs_seen   = 0;
+    descs_remote = 0;
     while(true) {
-      int e = rte_ring_sc_dequeue(to_cores[tid], (void **)&quorum);
-      if(e == 0) {
-	while(rte_ring_sc_dequeue(to_cores[tid], (void **)&m) != 0);
-	while(rte_ring_sc_dequeue(to_cores[tid], (void **)&client_buffer) != 0);
-	sz = client_buffer->payload_sz;
-	cstatus = &core_status[tid];
-	//client_buffer->timestamp = rte_get_tsc_cycles();
-	wal = pktadj2wal(m);
-	exec();
-	if(!is_multicore_rpc(client_buffer)) {
-	  quorums[quorum]->remove_inflight(client_buffer->client_id);
+      int cnt = rte_ring_sc_dequeue_burst(to_cores[tid], 
+					  descs, 
+					  executor_burst);
+      if(to_anycore != NULL && cnt < executor_burst) {
+	cnt += rte_ring_mc_dequeue_burst(to_anycore[core_to_quorum(tid)],
+					 descs + cnt,
+					 executor_burst - cnt);
+      }
+      unpark();
+      if(cnt == 0) {
+	spec_resolve(false);
+      }
+      if(cnt == 0 && poll) {
+	unsigned long now = rte_get_tsc_cycles();
+	if(now >= next_poll) {
+	  poll_flashlog();
+	  next_poll = now + POLL_TO;
 	}
-	else if(tid == (__builtin_ffsl(client_buffer->core_mask) - 1)){
-	  quorums[0]->remove_inflight(client_buffer->client_id);
+      }
+      for(int i=0;i<cnt;i++) {
+	if(descs[i] == NULL) { // Already run out of order
+	  continue;
 	}
-	rte_pktmbuf_free(m);
+	int q;
+	rpc_t *rpc;
+	rte_mbuf *mbuf = exec_desc_decode(descs[i], &q, &rpc);
+	count_remote(mbuf);
+	if(awaits_commit(rpc) && 
+	   !speculable(rpc) &&
+	   pktadj2wal(mbuf)->rep == REP_UNKNOWN) {
+	  // Don't hold committed requests behind an uncommitted one
+	  batch_flush();
+	  run_ready_ro(descs, i + 1, cnt);
+	}
+	run(descs[i]);
       }
+      batch_flush();
+      spec_resolve(false);
     }
   }
 } executor_t;
 
+// Owns all flash logs in offload mode: appends records handed over by
+// executors and publishes the durable index in their core status
+int dpdk_flashlogger(void *arg)
+{
+  void *desc;
+  while(true) {
+    for(int i=0;i<executor_threads;i++) {
+      int batch = 0;
+      while(batch < flashlog_offload_batch &&
+	    rte_ring_sc_dequeue(to_logger[i], &desc) == 0) {
+	int q;
+	rpc_t *rpc;
+	rte_mbuf *m = exec_desc_decode(desc, &q, &rpc);
+	int checkpoint_idx = log_append(offload_logs[i],
+					(const char *)rpc,
+					rpc->payload_sz + sizeof(rpc_t),
+					pktadj2wal(m)->idx);
+	rte_pktmbuf_free(m);
+	core_status[i].checkpoint_idx = checkpoint_idx;
+	batch++;
+      }
+      if(batch == 0) {
+	core_status[i].checkpoint_idx = log_poll(offload_logs[i]);
+      }
+    }
+    __sync_synchronize(); // publish core status
+  }
+  return 0;
+}
+
+void dispatcher_flashlog_offload(void **logs)
+{
+  offload_logs = logs;
+}
+
+void dispatcher_ro_anycore()
+{
+  ro_anycore = true;
+}
+
 int dpdk_executor(void *arg)
 {
   executor_t *ex = (executor_t *)arg;
@@ -361,8 +1272,9 @@ void dispatcher_start(const char* config_cluster_path,
   std::stringstream addr;
   boost::property_tree::read_ini(config_cluster_path, pt_cluster);
   boost::property_tree::read_ini(config_quorum_path, pt_quorum);
+  cyclone_config_init(config_quorum_path);
+  lcore_layout_init(config_quorum_path, offload_logs != NULL);
   // Load/Setup state
-  static PMEMobjpool *state;
   std::string file_path = pt_quorum.get<std::string>("dispatch.filepath");
   unsigned long heapsize = pt_quorum.get<unsigned long>("dispatch.heapsize");
   char me_str[100];
@@ -387,16 +1299,38 @@ void dispatcher_start(const char* config_cluster_path,
     sprintf(ringname, "TO_CORE%d", i);
     to_cores[i] =  rte_ring_create(ringname, 
 				   65536,
-				   rte_socket_id(), 
+				   rte_lcore_to_socket_id(lcore_layout.executor[i]), 
 				   RING_F_SC_DEQ); 
   }
 
+  if(offload_logs != NULL) {
+    to_logger = (struct rte_ring **)malloc(executor_threads*sizeof(struct rte_ring *));
+    for(int i=0;i<executor_threads;i++) {
+      sprintf(ringname, "TO_LOGGER%d", i);
+      to_logger[i] =  rte_ring_create(ringname, 
+				      65536,
+				      rte_lcore_to_socket_id(lcore_layout.logger), 
+				      RING_F_SP_ENQ|RING_F_SC_DEQ); 
+    }
+  }
+
+  if(ro_anycore) {
+    to_anycore = (struct rte_ring **)malloc(num_quorums*sizeof(struct rte_ring *));
+    for(int i=0;i<num_quorums;i++) {
+      sprintf(ringname, "TO_ANYCORE%d", i);
+      to_anycore[i] =  rte_ring_create(ringname, 
+				       65536,
+				       lcore_layout.quorum_socket[i], 
+				       0); 
+    }
+  }
+
   to_quorums = (struct rte_ring **)malloc(num_quorums*sizeof(struct rte_ring *));
   for(int i=0;i<num_quorums;i++) {
     sprintf(ringname, "TO_QUORUM%d", i);
     to_quorums[i] =  rte_ring_create(ringname, 
 				     65536,
-				     rte_socket_id(), 
+				     rte_lcore_to_socket_id(lcore_layout.raft[i]), 
 				     RING_F_SP_ENQ|RING_F_SC_DEQ); 
   }
 
@@ -433,20 +1367,57 @@ void dispatcher_start(const char* config_cluster_path,
 	<< strerror(errno);
       exit(-1);
     }
-    TOID(disp_state_t) root = POBJ_ROOT(state, disp_state_t);
     BOOST_LOG_TRIVIAL(info) << "DISPATCHER: Recovered state";
   }
+  TOID(disp_state_t) root = POBJ_ROOT(state, disp_state_t);
+  disp_state = D_RW(root);
+  // Moves made before a restart win over the configured map
+  if(disp_state->partition_map.version == 0) {
+    pmemobj_memcpy_persist(state,
+			   &disp_state->partition_map,
+			   &partition_map,
+			   sizeof(partition_map_t));
+  }
+  else {
+    const partition_map_t *saved = &disp_state->partition_map;
+    bool fits = (saved->partitions == partition_map.partitions);
+    for(int p=0;fits && p<saved->partitions;p++) {
+      fits = (saved->core[p] < executor_threads);
+    }
+    if(!fits) {
+      BOOST_LOG_TRIVIAL(fatal) << "Partition map in the dispatcher state "
+			       << "does not fit the config ("
+			       << saved->partitions << " partitions)";
+      exit(-1);
+    }
+    memcpy(&partition_map, &disp_state->partition_map, sizeof(partition_map_t));
+    BOOST_LOG_TRIVIAL(info) << "DISPATCHER: Partition map version "
+			    << partition_map.version;
+  }
   
   quorums = (cyclone_t **)malloc(num_quorums*sizeof(cyclone_t *));
-  core_status = (core_status_t *)malloc(executor_threads*sizeof(core_status_t));
+  batch_scratch = 
+    (batch_scratch_t *)malloc(executor_threads*sizeof(batch_scratch_t));
+  reply_scratch = 
+    (reply_scratch_t *)malloc(executor_threads*sizeof(reply_scratch_t));
+  for(int i=0;i<executor_threads;i++) {
+    reply_scratch[i].in_batch = false;
+  }
+  // Cache line aligned, rendezvous slots must not share lines
+  core_status = (core_status_t *)rte_zmalloc("core_status",
+					     executor_threads*sizeof(core_status_t),
+					     64);
+  if(core_status == NULL) {
+    BOOST_LOG_TRIVIAL(fatal) << "Failed to allocate core status";
+    exit(-1);
+  }
   for(int i=0;i < executor_threads;i++) {
     core_status[i].exec_term      = 0;
     core_status[i].checkpoint_idx = -1;
-    memset(&core_status[i].nonce, 0, sizeof(ic_rdv_t));
-    core_status[i].stable  = 0;
-    core_status[i].success = 0;
-    core_status[i].barrier[0] = 0;
-    core_status[i].barrier[1] = 0;
+    core_status[i].arrive.tag     = 0;
+    core_status[i].arrive.ok      = 0;
+    core_status[i].release.tag    = 0;
+    core_status[i].release.ok     = 0;
   }
   
   
@@ -463,18 +1434,31 @@ void dispatcher_start(const char* config_cluster_path,
   
   double tsc_mhz = (rte_get_tsc_hz()/1000000.0);
   unsigned long QUORUM_TO = RAFT_QUORUM_TO*tsc_mhz;
+  unsigned long POLL_TO   = (flashlog_seal_usecs/2)*tsc_mhz;
   
   for(int i=0;i < executor_threads;i++) {
     executor_t *ex = new executor_t();
     ex->tid = i;
     ex->replicas =  pt_quorum.get<int>("active.replicas");
     ex->QUORUM_TO = QUORUM_TO;
-    int e = rte_eal_remote_launch(dpdk_executor, (void *)ex, 1 + num_quorums + i);
+    ex->POLL_TO   = POLL_TO;
+    int e = rte_eal_remote_launch(dpdk_executor,
+				  (void *)ex,
+				  lcore_layout.executor[i]);
     if(e != 0) {
       BOOST_LOG_TRIVIAL(fatal) << "Failed to launch executor on remote lcore";
       exit(-1);
     }
   }
+  if(offload_logs != NULL) {
+    int e = rte_eal_remote_launch(dpdk_flashlogger, 
+				  NULL, 
+				  lcore_layout.logger);
+    if(e != 0) {
+      BOOST_LOG_TRIVIAL(fatal) << "Failed to launch flash logger on remote lcore";
+      exit(-1);
+    }
+  }
   rte_eal_mp_wait_lcore();
 }
 
@@ -4,6 +4,7 @@
 #include "libcyclone.hpp"
 POBJ_LAYOUT_BEGIN(disp_state);
 typedef struct disp_state_st {
+  partition_map_t partition_map; // Version 0 until set up from the config
 } disp_state_t;
 TOID_DECLARE_ROOT(disp_state_t);
 POBJ_LAYOUT_END(disp_state);
@@ -1,67 +1,391 @@
 #include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<unistd.h>
 #include<sys/types.h>
 #include<sys/stat.h>
 #include<fcntl.h>
+#include<glob.h>
+#include<errno.h>
+#include<linux/falloc.h>
 #include<libaio.h>
+#include<x86intrin.h>
+#include<zstd.h>
+#include<string>
+#include<deque>
+#include<vector>
+#include<boost/thread.hpp>
 #include "logging.hpp"
+#include "clock.hpp"
 #include "libcyclone.hpp"
+#include "flash_log.hpp"
+#include "spin_wait.hpp"
 typedef struct log_page_st {
-  struct iocb cb;
+  struct iocb cb; // Must be first -- completions are mapped back via iocb
   char *page;
+  char *cpage;      // Compressed copy of page
+  int raft_idx;     // Last raft idx on page at seal time
+  int issued_bytes;
+  bool done;
+  // Shared logs only
+  volatile unsigned long reserved;  // Entries << 32 | bytes
+  volatile unsigned long committed; // Bytes filled in
+  volatile int *writer_idx;         // Last raft idx on page per writer
+  volatile unsigned long start;     // Time of first record
 } log_page_t;
 
 
+typedef struct sealed_segment_st {
+  unsigned long segment;
+  int raft_idx; // Last raft idx in segment
+} sealed_segment_t;
+
 typedef struct flash_log_st {
+  std::string path;
   int log_fd;
-  log_page_t log_pages[2];
-  int active_page;
+  unsigned long segment;  // Current segment number
+  std::deque<sealed_segment_t> sealed_segments;
+  volatile int truncate_idx;
+  // Spare pool, protected by segment manager lock
+  std::deque<std::string> spares;
+  int spares_pending;
+  unsigned long spare_names;
+  log_page_t log_pages[flashlog_pipeline];
+  volatile int active_page;
+  int oldest_page;    // Oldest page with IO outstanding
+  int inflight_pages;
   int bytes_on_active_page;
   int entries_on_active_page;
+  unsigned int crc_on_active_page; // Over record headers
+  unsigned long page_seq;
   int raft_idx;
+  int issued_raft_idx; // Last raft idx submitted to current segment
   int checkpointed_raft_idx;
-  int inflight_raft_idx;
-  bool issued_io;
-  int issued_bytes;
   io_context_t ctx;
-  unsigned long logsize;
-  unsigned long max_logsize;
+  unsigned long logsize; // Offset within current segment
+  // Shared logs only
+  int writers;
+  volatile int *writer_checkpoint;
+  volatile int io_lock; // Shared logs: seal vs. poll
+  // Sealing
+  unsigned long page_start; // Time of first record on active page
+  double arrival_rate;      // EWMA, records/usec
+  int hwm;
+  // Compression
+  ZSTD_CCtx *zctx;
+  unsigned long raw_written;
+  unsigned long disk_written;
+  unsigned long compress_cycles;
+  unsigned long pages_written;
 } flash_log_t;
 
-static void log_switch_page(flash_log_t *log)
+/////////////////// Segment management /////////////////////
+// A flash log is a sequence of flashlog_segsize files <path>.<segment>.
+// Segments are taken from a small pool of preallocated, zeroed spares
+// <path>.spare<n> that a background thread keeps full. Segments wholly
+// below the truncation point are zeroed and returned to the pool.
+
+typedef struct segment_work_st {
+  flash_log_t *log;
+  std::string file; // Segment to recycle, empty for a refill
+} segment_work_t;
+
+// Never destroyed, the segment manager outlives static destructors
+static boost::mutex &segment_lock = *new boost::mutex();
+static boost::condition_variable &segment_cond = *new boost::condition_variable();
+static std::deque<segment_work_t> segment_work;
+static boost::thread *segment_thread = NULL;
+
+static std::string segment_name(flash_log_t *log, unsigned long segment)
+{
+  char suffix[32];
+  sprintf(suffix, ".%lu", segment);
+  return log->path + suffix;
+}
+
+static std::string spare_name(flash_log_t *log)
+{
+  char suffix[32];
+  sprintf(suffix, ".spare%lu", log->spare_names++);
+  return log->path + suffix;
+}
+
+// Parses <path>.<segment> and <path>.spare<n>, returns 0 for any other
+// file that happens to share the prefix
+static int log_file_number(flash_log_t *log,
+			   const char *file,
+			   bool *is_spare,
+			   unsigned long *n)
+{
+  std::string prefix = log->path + ".";
+  if(strncmp(file, prefix.c_str(), prefix.size()) != 0) {
+    return 0;
+  }
+  const char *digits = file + prefix.size();
+  *is_spare = (strncmp(digits, "spare", 5) == 0);
+  if(*is_spare) {
+    digits += 5;
+  }
+  if(*digits == 0) {
+    return 0;
+  }
+  for(const char *c = digits;*c != 0;c++) {
+    if(*c < '0' || *c > '9') {
+      return 0;
+    }
+  }
+  *n = strtoul(digits, NULL, 10);
+  return 1;
+}
+
+static void zero_segment(const std::string &file)
 {
-  struct iocb *ios[1];
-  struct io_event events[1];
   int e;
-  if(log->issued_io) {
-    log_page_t * inflight_page = &log->log_pages[1 - log->active_page];
-    e = 0;
-    while(e <= 0) {
-      e = io_getevents(log->ctx, 1, 1, events, NULL);
+  int fd = open(file.c_str(), O_WRONLY|O_CREAT, 0644);
+  if(fd == -1) {
+    BOOST_LOG_TRIVIAL(fatal) << "Unable to open flash log segment " << file;
+    exit(-1);
+  }
+  // Cheap on extent based filesystems, no data is written
+  if(fallocate(fd, FALLOC_FL_ZERO_RANGE, 0, flashlog_segsize) != 0) {
+    if(errno != EOPNOTSUPP) {
+      BOOST_LOG_TRIVIAL(fatal) << "Unable to zero flash log segment " << file;
+      exit(-1);
     }
-    if(events[0].res != log->issued_bytes) {
-      BOOST_LOG_TRIVIAL(fatal) << "Async IO reported failure:"
-			       << (int)events[0].res;
+    if(ftruncate(fd, 0) != 0) {
+      BOOST_LOG_TRIVIAL(fatal) << "Unable to truncate flash log segment " << file;
       exit(-1);
     }
-    log->checkpointed_raft_idx = log->inflight_raft_idx - 1;
   }
-  if(log->logsize >= log->max_logsize) {
-    if(e = posix_fallocate(log->log_fd, log->logsize, flashlog_segsize)) {
-      BOOST_LOG_TRIVIAL(fatal) << "preallocation failed: " << e;
+  if(e = posix_fallocate(fd, 0, flashlog_segsize)) {
+    BOOST_LOG_TRIVIAL(fatal) << "preallocation failed: " << e;
+    exit(-1);
+  }
+  close(fd);
+}
+
+static void segment_manager()
+{
+  while(true) {
+    boost::unique_lock<boost::mutex> lock(segment_lock);
+    while(segment_work.empty()) {
+      segment_cond.wait(lock);
+    }
+    segment_work_t work = segment_work.front();
+    segment_work.pop_front();
+    flash_log_t *log = work.log;
+    if(!work.file.empty() && 
+       log->spares.size() >= flashlog_spare_segments) {
+      log->spares_pending--;
+      lock.unlock();
+      unlink(work.file.c_str());
+      continue;
+    }
+    std::string spare = spare_name(log);
+    lock.unlock();
+    if(work.file.empty()) {
+      zero_segment(spare);
+    }
+    else {
+      if(rename(work.file.c_str(), spare.c_str()) != 0) {
+	BOOST_LOG_TRIVIAL(fatal) << "Unable to recycle flash log segment " 
+				 << work.file;
+	exit(-1);
+      }
+      zero_segment(spare);
+    }
+    lock.lock();
+    log->spares.push_back(spare);
+    log->spares_pending--;
+    segment_cond.notify_all();
+  }
+}
+
+// Caller holds segment_lock
+static void request_segment(flash_log_t *log, const std::string &file)
+{
+  segment_work_t work;
+  work.log  = log;
+  work.file = file;
+  segment_work.push_back(work);
+  log->spares_pending++;
+  segment_cond.notify_all();
+}
+
+static void refill_spares(flash_log_t *log)
+{
+  boost::unique_lock<boost::mutex> lock(segment_lock);
+  while(log->spares.size() + log->spares_pending < flashlog_spare_segments) {
+    request_segment(log, std::string());
+  }
+}
+
+// Move to the next segment, recycling segments below truncate_idx
+static void log_next_segment(flash_log_t *log)
+{
+  boost::unique_lock<boost::mutex> lock(segment_lock);
+  // Only segments sealed before this one -- their IOs have long completed
+  while(!log->sealed_segments.empty() &&
+	log->sealed_segments.front().raft_idx < log->truncate_idx) {
+    request_segment(log, segment_name(log, log->sealed_segments.front().segment));
+    log->sealed_segments.pop_front();
+  }
+  sealed_segment_t sealed;
+  sealed.segment  = log->segment;
+  sealed.raft_idx = log->issued_raft_idx;
+  log->sealed_segments.push_back(sealed);
+  if(log->spares.empty()) {
+    BOOST_LOG_TRIVIAL(warning) << "Flash log spare segments exhausted " 
+			       << log->path;
+    if(log->spares_pending == 0) {
+      request_segment(log, std::string());
+    }
+    while(log->spares.empty()) {
+      segment_cond.wait(lock);
+    }
+  }
+  std::string spare = log->spares.front();
+  log->spares.pop_front();
+  while(log->spares.size() + log->spares_pending < flashlog_spare_segments) {
+    request_segment(log, std::string());
+  }
+  lock.unlock();
+  log->segment++;
+  std::string file = segment_name(log, log->segment);
+  if(rename(spare.c_str(), file.c_str()) != 0) {
+    BOOST_LOG_TRIVIAL(fatal) << "Unable to install flash log segment " << file;
+    exit(-1);
+  }
+  int fd = open(file.c_str(), 
+		O_WRONLY|O_DIRECT|(flashlog_use_osync ? O_SYNC:0));
+  if(fd == -1) {
+    BOOST_LOG_TRIVIAL(fatal) << "Unable to open flash log segment " << file;
+    exit(-1);
+  }
+  // In flight IOs hold their own reference to the old file
+  if(log->log_fd != -1) {
+    close(log->log_fd);
+  }
+  log->log_fd  = fd;
+  log->logsize = 0;
+}
+
+// Reap completed IOs. Blocks only if min_events > 0.
+// checkpointed_raft_idx advances over the prefix of completed pages
+static void log_reap(flash_log_t *log, int min_events)
+{
+  struct io_event events[flashlog_pipeline];
+  struct timespec no_wait = {0, 0};
+  int e;
+  do {
+    e = io_getevents(log->ctx, 
+		     min_events, 
+		     flashlog_pipeline, 
+		     events, 
+		     min_events ? NULL:&no_wait);
+  } while(min_events > 0 && e <= 0);
+  for(int i=0;i<e;i++) {
+    log_page_t *page = (log_page_t *)events[i].obj;
+    if(events[i].res != page->issued_bytes) {
+      BOOST_LOG_TRIVIAL(fatal) << "Async IO reported failure:"
+			       << (int)events[i].res;
       exit(-1);
     }
-    log->max_logsize += flashlog_segsize;
+    page->done = true;
+  }
+  while(log->inflight_pages > 0 && log->log_pages[log->oldest_page].done) {
+    log->checkpointed_raft_idx = log->log_pages[log->oldest_page].raft_idx - 1;
+    for(int i=0;i<log->writers;i++) {
+      int idx = log->log_pages[log->oldest_page].writer_idx[i];
+      if(idx >= 0) {
+	log->writer_checkpoint[i] = idx - 1;
+      }
+    }
+    log->oldest_page = (log->oldest_page + 1) % flashlog_pipeline;
+    log->inflight_pages--;
+  }
+}
+
+// Compress records on page into cpage, returns bytes to write or 0 if
+// that would not save at least one 4KB block
+static unsigned long log_compress_page(flash_log_t *log, 
+				       log_page_t *page,
+				       unsigned long bytes)
+{
+  unsigned long start = __rdtsc();
+  size_t c = ZSTD_compressCCtx(log->zctx,
+			       page->cpage + sizeof(flashlog_page_t),
+			       flashlog_pagesize - sizeof(flashlog_page_t),
+			       page->page + sizeof(flashlog_page_t),
+			       bytes - sizeof(flashlog_page_t),
+			       flashlog_compress_level);
+  log->compress_cycles += (__rdtsc() - start);
+  if(ZSTD_isError(c)) {
+    return 0;
+  }
+  unsigned long cbytes = sizeof(flashlog_page_t) + c;
+  if((cbytes + 4095)/4096 >= (bytes + 4095)/4096) {
+    return 0;
+  }
+  memcpy(page->cpage, page->page, sizeof(flashlog_page_t));
+  return cbytes;
+}
+
+static void log_switch_page(flash_log_t *log)
+{
+  struct iocb *ios[1];
+  int e;
+  log_reap(log, 0);
+  // Backpressure only when every other page in the ring is in flight
+  while(log->inflight_pages == flashlog_pipeline - 1) {
+    log_reap(log, 1);
   }
   log_page_t * issue_page = &log->log_pages[log->active_page];
-  *(unsigned long *)issue_page->page = log->bytes_on_active_page;
+  if(log->logsize + ((log->bytes_on_active_page + 4095)/4096)*4096 > 
+     flashlog_segsize) {
+    log_next_segment(log);
+  }
+  flashlog_page_t *header = (flashlog_page_t *)issue_page->page;
+  header->bytes     = log->bytes_on_active_page;
+  header->raw_bytes = log->bytes_on_active_page;
+  header->seq       = log->page_seq++;
+  header->flags     = 0;
+  char *io_buffer = issue_page->page;
+  unsigned long io_bytes = log->bytes_on_active_page;
+  if(flashlog_compress) {
+    unsigned long cbytes = log_compress_page(log, issue_page, io_bytes);
+    if(cbytes > 0) {
+      io_buffer = issue_page->cpage;
+      io_bytes  = cbytes;
+      header = (flashlog_page_t *)issue_page->cpage;
+      header->bytes = cbytes;
+      header->flags = FLASHLOG_PAGE_ZSTD;
+    }
+    log->raw_written  += ((log->bytes_on_active_page + 4095)/4096)*4096;
+    log->disk_written += ((io_bytes + 4095)/4096)*4096;
+    if(++log->pages_written == flashlog_compress_report) {
+      BOOST_LOG_TRIVIAL(info) << "Flashlog compression ratio = "
+			      << ((double)log->raw_written)/log->disk_written
+			      << " cycles/byte = "
+			      << ((double)log->compress_cycles)/log->raw_written;
+      log->raw_written     = 0;
+      log->disk_written    = 0;
+      log->compress_cycles = 0;
+      log->pages_written   = 0;
+    }
+  }
+  header->crc   = flashlog_page_crc(header, log->crc_on_active_page);
   memset(&issue_page->cb, 0, sizeof(struct iocb));
   issue_page->cb.aio_lio_opcode = IO_CMD_PWRITE;
   issue_page->cb.aio_fildes      = log->log_fd;
-  issue_page->cb.u.c.buf         = issue_page->page;
-  log->issued_bytes              = ((log->bytes_on_active_page + 4095)/4096)*4096;
-  log->logsize                   += log->issued_bytes;
-  issue_page->cb.u.c.nbytes      = log->issued_bytes;
-  issue_page->cb.u.c.offset      = 0;
+  issue_page->cb.u.c.buf         = io_buffer;
+  issue_page->issued_bytes       = ((io_bytes + 4095)/4096)*4096;
+  issue_page->cb.u.c.nbytes      = issue_page->issued_bytes;
+  issue_page->cb.u.c.offset      = log->logsize;
+  issue_page->raft_idx           = log->raft_idx;
+  issue_page->done               = false;
+  log->logsize                  += issue_page->issued_bytes;
+  log->issued_raft_idx           = log->raft_idx;
   ios[0] = &issue_page->cb;
   e = io_submit(log->ctx, 1, ios);
   if(e < 1) {
@@ -70,97 +394,373 @@ static void log_switch_page(flash_log_t *log)
     BOOST_LOG_TRIVIAL(info) << "Flashlog fd = " << log->log_fd;
     exit(-1);
   }
-  log->active_page = 1 - log->active_page;
-  log->issued_io = true;
-  log->inflight_raft_idx = log->raft_idx;
-  log->bytes_on_active_page = sizeof(unsigned long);
+  if(log->inflight_pages == 0) {
+    log->oldest_page = log->active_page;
+  }
+  log->inflight_pages++;
+  if(log->writers == 0) {
+    // Size pages to what arrives within a seal deadline. The rate is
+    // sampled from the first record on the page, idle time between
+    // pages does not count.
+    unsigned long now = rtc_clock::current_time();
+    if(now > log->page_start) {
+      double sample = ((double)log->entries_on_active_page)/(now - log->page_start);
+      log->arrival_rate += (sample - log->arrival_rate)/flashlog_rate_ewma;
+    }
+    log->hwm = (int)(log->arrival_rate*flashlog_seal_usecs);
+    if(log->hwm < flashlog_hwm_min) {
+      log->hwm = flashlog_hwm_min;
+    }
+    else if(log->hwm > flashlog_hwm_max) {
+      log->hwm = flashlog_hwm_max;
+    }
+  }
+  log->bytes_on_active_page = sizeof(flashlog_page_t);
   log->entries_on_active_page = 0;
+  log->crc_on_active_page = crc32c_init;
+  int next_page = (log->active_page + 1) % flashlog_pipeline;
+  if(log->writers > 0) {
+    log_page_t *next = &log->log_pages[next_page];
+    for(int i=0;i<log->writers;i++) {
+      next->writer_idx[i] = -1;
+    }
+    next->committed = sizeof(flashlog_page_t);
+    next->start     = 0;
+    __sync_synchronize();
+    next->reserved  = sizeof(flashlog_page_t);
+    __sync_synchronize();
+  }
+  log->active_page = next_page;
 }
 
 void *create_flash_log(const char *path)
 {
   int e;
-  int fd = open(path, 
-		O_WRONLY|O_APPEND|O_TRUNC|O_CREAT|O_DIRECT|(flashlog_use_osync ? O_SYNC:0), 
-		0644);
-  if(fd == -1) {
-    BOOST_LOG_TRIVIAL(fatal) << "Unable to create flash log";
-    exit(-1);
+  flash_log_t *log = new flash_log_t();
+  log->path = path;
+  log->log_fd = -1;
+  log->segment = 0;
+  log->truncate_idx = -1;
+  log->spares_pending = 0;
+  log->spare_names = 0;
+  {
+    boost::unique_lock<boost::mutex> lock(segment_lock);
+    if(segment_thread == NULL) {
+      segment_thread = new boost::thread(segment_manager);
+    }
   }
-  BOOST_LOG_TRIVIAL(info) << "Preallocating flashlog segment";
-  if(e = posix_fallocate(fd, 0, flashlog_segsize)) {
-    BOOST_LOG_TRIVIAL(fatal) << "preallocation failed: " << e;
+  // Files from a previous run become spares instead of being reallocated.
+  // Renamed under segment_lock, the segment manager names spares too.
+  glob_t old_files;
+  std::string pattern = log->path + ".*";
+  if(glob(pattern.c_str(), 0, NULL, &old_files) == 0) {
+    boost::unique_lock<boost::mutex> lock(segment_lock);
+    std::vector<std::string> reuse;
+    for(size_t i=0;i<old_files.gl_pathc;i++) {
+      bool is_spare;
+      unsigned long n;
+      if(!log_file_number(log, old_files.gl_pathv[i], &is_spare, &n)) {
+	continue;
+      }
+      // New spare names must not collide with old ones
+      if(is_spare && n >= log->spare_names) {
+	log->spare_names = n + 1;
+      }
+      reuse.push_back(old_files.gl_pathv[i]);
+    }
+    for(size_t i=0;i<reuse.size();i++) {
+      std::string spare = spare_name(log);
+      if(rename(reuse[i].c_str(), spare.c_str()) != 0) {
+	BOOST_LOG_TRIVIAL(fatal) << "Unable to reuse flash log file "
+				 << reuse[i];
+	exit(-1);
+      }
+      request_segment(log, spare);
+    }
+  }
+  globfree(&old_files);
+  // First segment
+  if(log->spares_pending == 0) {
+    BOOST_LOG_TRIVIAL(info) << "Preallocating flashlog segment";
+    zero_segment(segment_name(log, 0));
+    BOOST_LOG_TRIVIAL(info) << "Done preallocating flashlog segment";
+  }
+  else {
+    boost::unique_lock<boost::mutex> lock(segment_lock);
+    while(log->spares.empty()) {
+      segment_cond.wait(lock);
+    }
+    std::string spare = log->spares.front();
+    log->spares.pop_front();
+    lock.unlock();
+    if(rename(spare.c_str(), segment_name(log, 0).c_str()) != 0) {
+      BOOST_LOG_TRIVIAL(fatal) << "Unable to install flash log segment";
+      exit(-1);
+    }
+  }
+  refill_spares(log);
+  log->log_fd = open(segment_name(log, 0).c_str(), 
+		     O_WRONLY|O_DIRECT|(flashlog_use_osync ? O_SYNC:0));
+  if(log->log_fd == -1) {
+    BOOST_LOG_TRIVIAL(fatal) << "Unable to create flash log";
     exit(-1);
   }
-  BOOST_LOG_TRIVIAL(info) << "Done preallocating flashlog segment";
-  flash_log_t *log = (flash_log_t *)malloc(sizeof(flash_log_t));
-  log->log_fd = fd;
-  BOOST_LOG_TRIVIAL(info) << "Flashlog fd = " << fd;
+  BOOST_LOG_TRIVIAL(info) << "Flashlog fd = " << log->log_fd;
   log->ctx = 0;
   if((e = io_setup(100, &log->ctx)) != 0) {
     BOOST_LOG_TRIVIAL(fatal) << "Failed to setup aio context:"
 			     << e;
     exit(-1);
   }
-  log->issued_io = false;
   log->logsize   = 0;
-  log->max_logsize = flashlog_segsize;
   log->active_page = 0;
-  if(posix_memalign((void **)&log->log_pages[0].page,
-		    4096, 
-		    flashlog_pagesize) != 0) {
-    BOOST_LOG_TRIVIAL(fatal) << "Failed to allocate aligned page";
-    exit(-1);
-  }
-  
-  memset(&log->log_pages[0].cb, 0, sizeof(iocb));
-  if(posix_memalign((void **)&log->log_pages[1].page,
-		    4096, 
-		    flashlog_pagesize) != 0) {
-    BOOST_LOG_TRIVIAL(fatal) << "Failed to allocate aligned page";
-    exit(-1);
+  log->oldest_page = 0;
+  log->inflight_pages = 0;
+  for(int i=0;i<flashlog_pipeline;i++) {
+    if(posix_memalign((void **)&log->log_pages[i].page,
+		      4096, 
+		      flashlog_pagesize) != 0) {
+      BOOST_LOG_TRIVIAL(fatal) << "Failed to allocate aligned page";
+      exit(-1);
+    }
+    log->log_pages[i].cpage = NULL;
+    if(flashlog_compress && 
+       posix_memalign((void **)&log->log_pages[i].cpage,
+		      4096, 
+		      flashlog_pagesize) != 0) {
+      BOOST_LOG_TRIVIAL(fatal) << "Failed to allocate aligned page";
+      exit(-1);
+    }
+    memset(&log->log_pages[i].cb, 0, sizeof(iocb));
+    log->log_pages[i].done = false;
+    log->log_pages[i].reserved   = sizeof(flashlog_page_t);
+    log->log_pages[i].committed  = sizeof(flashlog_page_t);
+    log->log_pages[i].writer_idx = NULL;
   }
-  memset(&log->log_pages[1].cb, 0, sizeof(iocb));
+  log->writers = 0;
+  log->writer_checkpoint = NULL;
+  log->io_lock = 0;
+  log->page_start   = 0;
+  log->arrival_rate = ((double)flashlog_hwm)/flashlog_seal_usecs;
+  log->hwm          = flashlog_hwm;
+  log->zctx = flashlog_compress ? ZSTD_createCCtx():NULL;
+  log->raw_written     = 0;
+  log->disk_written    = 0;
+  log->compress_cycles = 0;
+  log->pages_written   = 0;
   log->raft_idx = -1;
+  log->issued_raft_idx = -1;
   log->checkpointed_raft_idx = -1;
-  log->bytes_on_active_page = sizeof(unsigned long);
+  log->bytes_on_active_page = sizeof(flashlog_page_t);
   log->entries_on_active_page = 0;
+  log->crc_on_active_page = crc32c_init;
+  log->page_seq = 0;
   return (void *)log;
 }
 
+int log_poll(void *log_)
+{
+  flash_log_t *log = (flash_log_t *)log_;
+  if(log->entries_on_active_page > 0 &&
+     rtc_clock::current_time() - log->page_start >= flashlog_seal_usecs) {
+    log_switch_page(log);
+  }
+  else if(log->inflight_pages > 0) {
+    log_reap(log, 0);
+  }
+  return log->checkpointed_raft_idx;
+}
+
+void flash_log_truncate(void *log_, int raft_idx)
+{
+  flash_log_t *log = (flash_log_t *)log_;
+  log->truncate_idx = raft_idx;
+}
+
 int log_append(void *log_, 
 	       const char *data, 
 	       int size,
 	       int raft_idx)
 {
   flash_log_t *log = (flash_log_t *)log_;
-  int bytes_left = flashlog_pagesize - log->bytes_on_active_page;
-  if(bytes_left < (size + sizeof(unsigned long))) {
+  int rec_bytes = flashlog_record_bytes(size);
+  if(log->bytes_on_active_page + rec_bytes > flashlog_pagesize) {
     log_switch_page(log);
   }
-  else if(log->entries_on_active_page >= flashlog_hwm) {
+  else if(log->entries_on_active_page >= log->hwm) {
     log_switch_page(log);
   }
-  unsigned long stop_byte = log->bytes_on_active_page + size - 1;
-  // Skip to next page if necessary
-  if(stop_byte/4096 != log->bytes_on_active_page/4096) {
-    if(bytes_left < 4096) {
+  int start = log->bytes_on_active_page;
+  // Skip to next 4K block if necessary
+  if((start % 4096) != 0 && start/4096 != (start + rec_bytes - 1)/4096) {
+    int next_block = ((start + 4095)/4096)*4096;
+    if(next_block + rec_bytes > flashlog_pagesize) {
       log_switch_page(log);
     }
     else {
-      log->bytes_on_active_page = 
-	((log->bytes_on_active_page + 4096)/4096)*4096;
+      flashlog_record_t *pad = (flashlog_record_t *)
+	(log->log_pages[log->active_page].page + start);
+      pad->size     = -1;
+      pad->raft_idx = -1;
+      pad->crc      = 0;
+      pad->writer   = 0;
+      log->crc_on_active_page = crc32c_extend(log->crc_on_active_page,
+					      pad,
+					      sizeof(flashlog_record_t));
+      log->bytes_on_active_page = next_block;
     }
   }
   char *buffer = log->log_pages[log->active_page].page;
   buffer = buffer + log->bytes_on_active_page;
-  *(unsigned long *)buffer = size;
-  buffer = buffer + sizeof(unsigned long);
-  memcpy(buffer, data, size);
-  log->bytes_on_active_page += (size + sizeof(unsigned long));
+  flashlog_record_t *rec = (flashlog_record_t *)buffer;
+  rec->size     = size;
+  rec->raft_idx = raft_idx;
+  rec->crc      = crc32c(data, size);
+  rec->writer   = 0;
+  memcpy(rec + 1, data, size);
+  log->crc_on_active_page = crc32c_extend(log->crc_on_active_page,
+					  rec,
+					  sizeof(flashlog_record_t));
+  if(log->entries_on_active_page == 0) {
+    log->page_start = rtc_clock::current_time();
+  }
+  log->bytes_on_active_page += rec_bytes;
   log->entries_on_active_page++;
   log->raft_idx = raft_idx;
   return log->checkpointed_raft_idx;
 }
 
+/////////////////// Shared log /////////////////////
+// Writers reserve space on the active page with a single fetch-add of
+// (1 entry, record bytes) and fill in their record in place. The first
+// writer whose reservation overflows the page (bytes or entries) seals
+// it: it waits for the earlier writers to finish, submits the page and
+// publishes the next one. Later overflowing writers wait for the switch.
+
+void *create_shared_flash_log(const char *path, int writers)
+{
+  flash_log_t *log = (flash_log_t *)create_flash_log(path);
+  log->writers = writers;
+  log->writer_checkpoint = new int[writers];
+  for(int i=0;i<writers;i++) {
+    log->writer_checkpoint[i] = -1;
+  }
+  for(int i=0;i<flashlog_pipeline;i++) {
+    log->log_pages[i].writer_idx = new int[writers];
+    for(int j=0;j<writers;j++) {
+      log->log_pages[i].writer_idx[j] = -1;
+    }
+  }
+  return (void *)log;
+}
+
+// Caller holds io_lock
+static void shared_log_seal_locked(flash_log_t *log, 
+				   log_page_t *page, 
+				   unsigned long bytes)
+{
+  spin_wait_t w;
+  spin_wait_init(&w);
+  unsigned long committed;
+  while((committed = page->committed) != bytes) {
+    // Low word changes with every record committed
+    spin_wait_step(&w, (volatile int *)&page->committed, (int)committed);
+  }
+  // Records were placed concurrently, so accumulate the crc here
+  unsigned int crc = crc32c_init;
+  unsigned long cursor = sizeof(flashlog_page_t);
+  while(cursor < bytes) {
+    flashlog_record_t *rec = (flashlog_record_t *)(page->page + cursor);
+    crc = crc32c_extend(crc, rec, sizeof(flashlog_record_t));
+    cursor += flashlog_record_bytes(rec->size);
+  }
+  // Last raft idx on the page, as for a private log
+  for(int i=0;i<log->writers;i++) {
+    if(page->writer_idx[i] > log->raft_idx) {
+      log->raft_idx = page->writer_idx[i];
+    }
+  }
+  log->bytes_on_active_page = bytes;
+  log->crc_on_active_page   = crc;
+  log_switch_page(log);
+}
+
+static void shared_log_seal(flash_log_t *log, 
+			    log_page_t *page, 
+			    unsigned long bytes)
+{
+  // Also orders us after the seal that published this page
+  while(__sync_lock_test_and_set(&log->io_lock, 1)) {
+    spin_wait_while(&log->io_lock, 1);
+  }
+  shared_log_seal_locked(log, page, bytes);
+  __sync_lock_release(&log->io_lock);
+}
+
+int shared_log_append(void *log_,
+		      int writer,
+		      const char *data, 
+		      int size,
+		      int raft_idx)
+{
+  flash_log_t *log = (flash_log_t *)log_;
+  unsigned long rec_bytes = flashlog_record_bytes(size);
+  while(true) {
+    int p = log->active_page;
+    log_page_t *page = &log->log_pages[p];
+    unsigned long r = __sync_fetch_and_add(&page->reserved, 
+					   (1UL << 32) | rec_bytes);
+    unsigned long offset  = r & 0xffffffffUL;
+    unsigned long entries = r >> 32;
+    if(entries < flashlog_shared_hwm && 
+       offset + rec_bytes <= flashlog_pagesize) {
+      flashlog_record_t *rec = (flashlog_record_t *)(page->page + offset);
+      rec->size     = size;
+      rec->raft_idx = raft_idx;
+      rec->crc      = crc32c(data, size);
+      rec->writer   = writer;
+      memcpy(rec + 1, data, size);
+      page->writer_idx[writer] = raft_idx;
+      if(entries == 0) {
+	page->start = rtc_clock::current_time();
+      }
+      __sync_fetch_and_add(&page->committed, rec_bytes);
+      return log->writer_checkpoint[writer];
+    }
+    if(entries <= flashlog_shared_hwm && offset <= flashlog_pagesize) {
+      shared_log_seal(log, page, offset);
+    }
+    else {
+      spin_wait_while(&log->active_page, p);
+    }
+  }
+}
 
+// Seal the active page once it is older than the deadline by closing it
+// to further entries. Whoever holds the first overflowing reservation
+// seals, as in shared_log_append. Done under io_lock, so the page cannot
+// be sealed and recycled for reuse between reading and closing it.
+int shared_log_poll(void *log_, int writer)
+{
+  flash_log_t *log = (flash_log_t *)log_;
+  if(__sync_lock_test_and_set(&log->io_lock, 1) != 0) {
+    return log->writer_checkpoint[writer];
+  }
+  log_page_t *page = &log->log_pages[log->active_page];
+  unsigned long start = page->start;
+  if(start != 0 && 
+     rtc_clock::current_time() - start >= flashlog_seal_usecs) {
+    unsigned long r = __sync_fetch_and_add(&page->reserved, 
+					   ((unsigned long)flashlog_shared_hwm) << 32);
+    unsigned long offset  = r & 0xffffffffUL;
+    unsigned long entries = r >> 32;
+    if(entries <= flashlog_shared_hwm && offset <= flashlog_pagesize) {
+      shared_log_seal_locked(log, page, offset);
+    }
+  }
+  else if(log->inflight_pages > 0) {
+    log_reap(log, 0);
+  }
+  __sync_lock_release(&log->io_lock);
+  return log->writer_checkpoint[writer];
+}
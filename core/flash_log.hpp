@@ -0,0 +1,50 @@
+#ifndef _FLASH_LOG_
+#define _FLASH_LOG_
+#include "crc32c.hpp"
+// On-flash layout of a flash log.
+// A log is a sequence of pages, each padded out to a multiple of 4KB.
+// Every page starts with a page header followed by 16 byte aligned records.
+// A record of negative size pads to the next 4KB boundary.
+// A page header with zero bytes (preallocated space) marks the end of log.
+// Pages carry consecutive sequence numbers starting from 0.
+// Each record carries a CRC32C of its payload. The page CRC32C covers the
+// page header fields and every record header on the page, so together
+// they detect a torn page write.
+// A page may be stored with everything after the header compressed as a
+// single zstd frame, raw_bytes then gives the size once decompressed.
+
+static const unsigned int FLASHLOG_PAGE_ZSTD = 1;
+
+typedef struct flashlog_page_st {
+  unsigned long bytes; // Bytes on flash including this header
+  unsigned long seq;
+  unsigned int crc;
+  unsigned int flags;
+  unsigned long raw_bytes; // Uncompressed bytes including this header
+} flashlog_page_t;
+
+typedef struct flashlog_record_st {
+  int size;     // Bytes of payload following this header
+  int raft_idx;
+  unsigned int crc; // Payload crc
+  int writer;       // Executor, for shared logs
+} flashlog_record_t;
+
+static int flashlog_record_bytes(int size)
+{
+  // Alignment leaves room for a padding record before any 4KB boundary
+  return ((sizeof(flashlog_record_t) + size + 15)/16)*16;
+}
+
+// crc accumulates over record headers as they are added to the page
+static unsigned int flashlog_page_crc(const flashlog_page_t *page,
+				      unsigned int crc)
+{
+  crc = crc32c_extend(crc, &page->bytes, sizeof(page->bytes));
+  crc = crc32c_extend(crc, &page->seq, sizeof(page->seq));
+  crc = crc32c_extend(crc, &page->flags, sizeof(page->flags));
+  crc = crc32c_extend(crc, &page->raw_bytes, sizeof(page->raw_bytes));
+  return crc32c_final(crc);
+}
+
+#endif
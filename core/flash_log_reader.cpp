@@ -0,0 +1,557 @@
+// Flash log reader and crash recovery replay
+#include<stdlib.h>
+#include<unistd.h>
+#include<sys/types.h>
+#include<sys/stat.h>
+#include<sys/mman.h>
+#include<fcntl.h>
+#include<glob.h>
+#include<stdio.h>
+#include<string>
+#include<vector>
+#include<map>
+#include<algorithm>
+#include<boost/thread.hpp>
+#include<zstd.h>
+#include "logging.hpp"
+#include "clock.hpp"
+#include "libcyclone.hpp"
+#include "cyclone.hpp"
+#include "flash_log.hpp"
+
+typedef struct flash_log_reader_st {
+  std::string path;
+  std::vector<std::pair<const char *, unsigned long> > maps; // Until close
+  unsigned long segment;
+  const char *base;
+  unsigned long size;
+  unsigned long page_offset;
+  unsigned long page_disk_bytes;
+  const char *page;     // Current page, mapped or decompressed
+  unsigned long page_bytes;
+  unsigned long cursor; // Offset within current page
+  std::vector<char *> buffers; // Decompressed pages, until close
+  unsigned long next_seq;
+  bool seq_known;       // Log may start at a recycled point
+  int writer;           // Of the last record returned
+} flash_log_reader_t;
+
+static bool map_segment(flash_log_reader_t *reader, unsigned long segment)
+{
+  struct stat st;
+  char suffix[32];
+  sprintf(suffix, ".%lu", segment);
+  std::string file = reader->path + suffix;
+  int fd = open(file.c_str(), O_RDONLY);
+  if(fd == -1) {
+    return false;
+  }
+  if(fstat(fd, &st) != 0) {
+    BOOST_LOG_TRIVIAL(fatal) << "Unable to stat flash log " << file;
+    exit(-1);
+  }
+  reader->segment     = segment;
+  reader->base        = NULL;
+  reader->size        = st.st_size;
+  reader->page_offset = 0;
+  reader->page_disk_bytes = 0;
+  reader->page_bytes  = 0;
+  reader->cursor      = 0;
+  if(reader->size > 0) {
+    reader->base = (const char *)mmap(NULL, 
+				      reader->size, 
+				      PROT_READ, 
+				      MAP_PRIVATE, 
+				      fd, 
+				      0);
+    if(reader->base == MAP_FAILED) {
+      BOOST_LOG_TRIVIAL(fatal) << "Unable to map flash log " << file;
+      exit(-1);
+    }
+    reader->maps.push_back(std::make_pair(reader->base, reader->size));
+  }
+  close(fd);
+  return true;
+}
+
+// Check sequence number and page crc before handing out any record
+static bool flash_log_page_valid(flash_log_reader_t *reader,
+				 const flashlog_page_t *page,
+				 const char *base,
+				 unsigned long bytes)
+{
+  if(page->seq != reader->next_seq) {
+    return false;
+  }
+  unsigned int crc = crc32c_init;
+  unsigned long cursor = sizeof(flashlog_page_t);
+  while(cursor + sizeof(flashlog_record_t) <= bytes) {
+    const flashlog_record_t *rec = (const flashlog_record_t *)(base + cursor);
+    crc = crc32c_extend(crc, rec, sizeof(flashlog_record_t));
+    if(rec->size < 0) {
+      cursor = ((cursor + 4096)/4096)*4096;
+    }
+    else if(rec->size > flashlog_pagesize) {
+      return false;
+    }
+    else {
+      cursor += flashlog_record_bytes(rec->size);
+    }
+  }
+  return flashlog_page_crc(page, crc) == page->crc;
+}
+
+void *open_flash_log(const char *path)
+{
+  flash_log_reader_t *reader = new flash_log_reader_t();
+  reader->path      = path;
+  reader->base      = NULL;
+  reader->size      = 0;
+  reader->page_offset = 0;
+  reader->page_disk_bytes = 0;
+  reader->page_bytes  = 0;
+  reader->cursor    = 0;
+  reader->next_seq  = 0;
+  reader->seq_known = false;
+  // Start from the oldest segment not yet recycled
+  glob_t files;
+  std::string pattern = reader->path + ".*";
+  bool found = false;
+  unsigned long first = 0;
+  if(glob(pattern.c_str(), 0, NULL, &files) == 0) {
+    for(size_t i=0;i<files.gl_pathc;i++) {
+      const char *suffix = files.gl_pathv[i] + reader->path.size() + 1;
+      char *end;
+      unsigned long segment = strtoul(suffix, &end, 10);
+      if(end == suffix || *end != 0) {
+	continue; // Spare
+      }
+      if(!found || segment < first) {
+	first = segment;
+	found = true;
+      }
+    }
+  }
+  globfree(&files);
+  if(!found || !map_segment(reader, first)) {
+    BOOST_LOG_TRIVIAL(warning) << "No flash log segments for " << path;
+  }
+  return (void *)reader;
+}
+
+int flash_log_read(void *reader_,
+		   const unsigned char **data,
+		   int *size,
+		   int *raft_idx)
+{
+  flash_log_reader_t *reader = (flash_log_reader_t *)reader_;
+  while(true) {
+    if(reader->cursor >= reader->page_bytes) {
+      if(reader->page_disk_bytes > 0) {
+	reader->page_offset += ((reader->page_disk_bytes + 4095)/4096)*4096;
+	reader->page_disk_bytes = 0;
+      }
+      const flashlog_page_t *page = (const flashlog_page_t *)
+	(reader->base + reader->page_offset);
+      if(reader->page_offset + sizeof(flashlog_page_t) > reader->size ||
+	 page->bytes < sizeof(flashlog_page_t) ||
+	 page->bytes > flashlog_pagesize ||
+	 reader->page_offset + page->bytes > reader->size) {
+	// End of segment, the log may continue in the next one
+	if(reader->base != NULL && map_segment(reader, reader->segment + 1)) {
+	  continue;
+	}
+	return 0; // End of log
+      }
+      if(!reader->seq_known) {
+	reader->next_seq  = page->seq;
+	reader->seq_known = true;
+      }
+      const char *records = (const char *)page;
+      if(page->flags & FLASHLOG_PAGE_ZSTD) {
+	if(page->raw_bytes > flashlog_pagesize ||
+	   page->raw_bytes < sizeof(flashlog_page_t)) {
+	  BOOST_LOG_TRIVIAL(warning) << "Bad compressed flash log page at offset "
+				     << reader->page_offset;
+	  return 0;
+	}
+	char *raw = (char *)malloc(page->raw_bytes);
+	size_t d = ZSTD_decompress(raw + sizeof(flashlog_page_t),
+				   page->raw_bytes - sizeof(flashlog_page_t),
+				   records + sizeof(flashlog_page_t),
+				   page->bytes - sizeof(flashlog_page_t));
+	if(ZSTD_isError(d) || 
+	   d != page->raw_bytes - sizeof(flashlog_page_t)) {
+	  free(raw);
+	  BOOST_LOG_TRIVIAL(warning) << "Torn compressed flash log page at offset "
+				     << reader->page_offset;
+	  return 0;
+	}
+	memcpy(raw, page, sizeof(flashlog_page_t));
+	reader->buffers.push_back(raw);
+	records = raw;
+      }
+      else if(page->raw_bytes != page->bytes) {
+	BOOST_LOG_TRIVIAL(warning) << "Bad flash log page at offset "
+				   << reader->page_offset;
+	return 0;
+      }
+      if(!flash_log_page_valid(reader, page, records, page->raw_bytes)) {
+	BOOST_LOG_TRIVIAL(warning) << "Torn or stale flash log page at offset "
+				   << reader->page_offset;
+	return 0;
+      }
+      reader->next_seq++;
+      reader->page            = records;
+      reader->page_disk_bytes = page->bytes;
+      reader->page_bytes      = page->raw_bytes;
+      reader->cursor          = sizeof(flashlog_page_t);
+      continue;
+    }
+    if(reader->cursor + sizeof(flashlog_record_t) > reader->page_bytes) {
+      reader->cursor = reader->page_bytes;
+      continue;
+    }
+    const flashlog_record_t *rec = (const flashlog_record_t *)
+      (reader->page + reader->cursor);
+    if(rec->size < 0) { // Padding
+      reader->cursor = ((reader->cursor + 4096)/4096)*4096;
+      continue;
+    }
+    if(rec->size > flashlog_pagesize ||
+       reader->cursor + flashlog_record_bytes(rec->size) > reader->page_bytes) {
+      BOOST_LOG_TRIVIAL(warning) << "Flash log record overruns page at offset "
+				 << reader->page_offset;
+      return 0;
+    }
+    if(crc32c(rec + 1, rec->size) != rec->crc) {
+      BOOST_LOG_TRIVIAL(warning) << "Flash log record checksum mismatch at offset "
+				 << reader->page_offset + reader->cursor;
+      return 0;
+    }
+    *data     = (const unsigned char *)(rec + 1);
+    *size     = rec->size;
+    *raft_idx = rec->raft_idx;
+    reader->writer = rec->writer;
+    reader->cursor += flashlog_record_bytes(rec->size);
+    return 1;
+  }
+}
+
+void close_flash_log(void *reader_)
+{
+  flash_log_reader_t *reader = (flash_log_reader_t *)reader_;
+  for(size_t i=0;i<reader->maps.size();i++) {
+    munmap((void *)reader->maps[i].first, reader->maps[i].second);
+  }
+  for(size_t i=0;i<reader->buffers.size();i++) {
+    free(reader->buffers[i]);
+  }
+  delete reader;
+}
+
+/////////////////// Replay /////////////////////
+
+typedef struct replay_record_st {
+  int raft_idx;
+  int core;
+  const rpc_t *rpc;
+  int len; // Including rpc_t header
+} replay_record_t;
+
+static bool replay_order(const replay_record_t &a, const replay_record_t &b)
+{
+  return a.raft_idx < b.raft_idx;
+}
+
+// Multi-core ops are applied once, by the quorum of the leader core,
+// after every other participating quorum has replayed up to the op
+typedef struct replay_rdv_st {
+  int arrived;
+  bool done;
+} replay_rdv_t;
+
+static boost::mutex rdv_lock;
+static boost::condition_variable rdv_cond;
+static std::map<unsigned long, replay_rdv_t> rdvs;
+static bool *quorum_finished;
+
+typedef struct replay_quorum_st {
+  int quorum;
+  std::vector<replay_record_t> records;
+  rpc_callbacks_t *callbacks;
+  unsigned long applied;
+  unsigned long skipped;
+  rpc_cookie_t *cookies;
+  const unsigned char **user_data;
+  int *user_len;
+  int batched;
+
+  void flush()
+  {
+    if(batched == 0) {
+      return;
+    }
+    if(callbacks->rpc_batch_callback != NULL) {
+      callbacks->rpc_batch_callback(user_data, user_len, cookies, batched);
+    }
+    else {
+      for(int i=0;i<batched;i++) {
+	callbacks->rpc_callback(user_data[i], user_len[i], &cookies[i]);
+      }
+    }
+    for(int i=0;i<batched && callbacks->gc_callback != NULL;i++) {
+      callbacks->gc_callback(&cookies[i]);
+    }
+    applied += batched;
+    batched = 0;
+  }
+
+  void add(const replay_record_t *r)
+  {
+    const unsigned char *data = (const unsigned char *)(r->rpc + 1);
+    int len = r->len - sizeof(rpc_t);
+    if(is_multicore_rpc((rpc_t *)r->rpc)) {
+      data += num_quorums*sizeof(unsigned int) + sizeof(ic_rdv_t);
+      len  -= num_quorums*sizeof(unsigned int) + sizeof(ic_rdv_t);
+    }
+    if(((rpc_t *)r->rpc)->flags & RPC_FLAG_BATCH) { // Each op on its own
+      const unsigned char *op_data[batch_max_ops];
+      int op_len[batch_max_ops];
+      int ops = batch_split(data, len, op_data, op_len);
+      for(int i=0;i<ops;i++) {
+	add_op(r, op_data[i], op_len[i]);
+      }
+      return;
+    }
+    add_op(r, data, len);
+  }
+
+  void add_op(const replay_record_t *r, const unsigned char *data, int len)
+  {
+    rpc_cookie_t *cookie = &cookies[batched];
+    cookie->core_id   = r->core;
+    cookie->core_mask = core_mask_single(r->core); // Replayed once, on the leader
+    cookie->log_idx   = r->raft_idx;
+    cookie->ret_value = NULL;
+    cookie->ret_size  = 0;
+    cookie->reply_mbuf  = NULL;
+    cookie->speculative = 0;
+    cookie->single_exec = 0;
+    cookie->ret_code    = 0;
+    user_data[batched] = data;
+    user_len[batched]  = len;
+    if(++batched == flashlog_replay_batch) {
+      flush();
+    }
+  }
+
+  // Returns true if op should be applied by this quorum
+  bool rendezvous(const rpc_t *rpc, int leader_quorum, int participants)
+  {
+    unsigned long tag = rpc2rdv((rpc_t *)rpc)->rtc_ts;
+    unsigned long quorum_mask = 0;
+    core_mask_t cores = rpc->core_mask;
+    for_each_core(c, cores) {
+      quorum_mask |= (1UL << core_to_quorum(c));
+    }
+    boost::unique_lock<boost::mutex> lock(rdv_lock);
+    replay_rdv_t *rdv = &rdvs[tag];
+    if(quorum != leader_quorum) {
+      rdv->arrived++;
+      rdv_cond.notify_all();
+      while(!rdv->done && !quorum_finished[leader_quorum]) {
+	rdv_cond.wait(lock);
+      }
+      if(!rdv->done) {
+	skipped++; // Leader never logged it -- raft log holds the op
+      }
+      return false;
+    }
+    while(true) {
+      int accounted = rdv->arrived;
+      for(int q=0;q<num_quorums;q++) {
+	if(q != quorum && (quorum_mask & (1UL << q)) && quorum_finished[q]) {
+	  accounted++;
+	}
+      }
+      if(accounted >= participants - 1) {
+	break;
+      }
+      rdv_cond.wait(lock);
+    }
+    return true;
+  }
+
+  void complete_rendezvous(const rpc_t *rpc)
+  {
+    unsigned long tag = rpc2rdv((rpc_t *)rpc)->rtc_ts;
+    boost::unique_lock<boost::mutex> lock(rdv_lock);
+    rdvs[tag].done = true;
+    rdv_cond.notify_all();
+  }
+
+  void operator() ()
+  {
+    std::stable_sort(records.begin(), records.end(), replay_order);
+    cookies   = new rpc_cookie_t[flashlog_replay_batch];
+    user_data = new const unsigned char *[flashlog_replay_batch];
+    user_len  = new int[flashlog_replay_batch];
+    batched   = 0;
+    applied   = 0;
+    skipped   = 0;
+    for(std::vector<replay_record_t>::iterator r = records.begin();
+	r != records.end();
+	r++) {
+      if(r->rpc->code != RPC_REQ || (r->rpc->flags & RPC_FLAG_RO)) {
+	continue;
+      }
+      if(!is_multicore_rpc((rpc_t *)r->rpc)) {
+	add(&(*r));
+	continue;
+      }
+      // One copy per quorum: the lowest core in the mask on this quorum
+      core_mask_t cores = r->rpc->core_mask;
+      int rep_core = -1;
+      int participants = 0;
+      unsigned long seen = 0;
+      for_each_core(c, cores) {
+	if(rep_core == -1 && core_to_quorum(c) == quorum) {
+	  rep_core = c;
+	}
+	if(!(seen & (1UL << core_to_quorum(c)))) {
+	  seen |= (1UL << core_to_quorum(c));
+	  participants++;
+	}
+      }
+      if(r->core != rep_core) {
+	continue;
+      }
+      flush();
+      int core_leader = core_mask_first(cores);
+      int leader_quorum = core_to_quorum(core_leader);
+      if(rendezvous(r->rpc, leader_quorum, participants)) {
+	replay_record_t leader_copy = *r;
+	leader_copy.core = core_leader;
+	add(&leader_copy);
+	flush();
+	complete_rendezvous(r->rpc);
+      }
+    }
+    flush();
+    boost::unique_lock<boost::mutex> lock(rdv_lock);
+    quorum_finished[quorum] = true;
+    rdv_cond.notify_all();
+  }
+} replay_quorum_t;
+
+typedef struct replay_scan_st {
+  const char *path;
+  int core; // -1 for a shared log, taken from each record
+  void *reader;
+  std::vector<replay_record_t> records;
+  unsigned long bytes;
+  void operator() ()
+  {
+    replay_record_t r;
+    const unsigned char *data;
+    bytes = 0;
+    reader = open_flash_log(path);
+    while(flash_log_read(reader, &data, &r.len, &r.raft_idx)) {
+      r.core = (core == -1) ? ((flash_log_reader_t *)reader)->writer:core;
+      if(r.len < sizeof(rpc_t) || r.core < 0 || r.core >= executor_threads) {
+	continue;
+      }
+      r.rpc = (const rpc_t *)data;
+      records.push_back(r);
+      bytes += r.len;
+    }
+  }
+} replay_scan_t;
+
+static unsigned long replay_logs(replay_scan_t *scans,
+				 int logs,
+				 rpc_callbacks_t *callbacks)
+{
+  unsigned long mark = rtc_clock::current_time();
+  boost::thread_group scanners;
+  for(int i=0;i<logs;i++) {
+    scanners.create_thread(boost::ref(scans[i]));
+  }
+  scanners.join_all();
+  unsigned long records = 0;
+  unsigned long bytes   = 0;
+  for(int i=0;i<logs;i++) {
+    records += scans[i].records.size();
+    bytes   += scans[i].bytes;
+  }
+  unsigned long scan_time = rtc_clock::current_time() - mark;
+  BOOST_LOG_TRIVIAL(info) << "Flashlog replay scanned "
+			  << records << " records "
+			  << bytes << " bytes in "
+			  << scan_time << " us";
+  
+  mark = rtc_clock::current_time();
+  quorum_finished = new bool[num_quorums];
+  replay_quorum_t *replays = new replay_quorum_t[num_quorums];
+  for(int q=0;q<num_quorums;q++) {
+    quorum_finished[q]    = false;
+    replays[q].quorum     = q;
+    replays[q].callbacks  = callbacks;
+  }
+  for(int i=0;i<logs;i++) {
+    for(std::vector<replay_record_t>::iterator r = scans[i].records.begin();
+	r != scans[i].records.end();
+	r++) {
+      replays[core_to_quorum(r->core)].records.push_back(*r);
+    }
+  }
+  boost::thread_group appliers;
+  for(int q=0;q<num_quorums;q++) {
+    appliers.create_thread(boost::ref(replays[q]));
+  }
+  appliers.join_all();
+  unsigned long applied = 0;
+  unsigned long skipped = 0;
+  for(int q=0;q<num_quorums;q++) {
+    applied += replays[q].applied;
+    skipped += replays[q].skipped;
+  }
+  unsigned long apply_time = rtc_clock::current_time() - mark;
+  BOOST_LOG_TRIVIAL(info) << "Flashlog replay applied "
+			  << applied << " requests in "
+			  << apply_time << " us "
+			  << "RATE = "
+			  << (apply_time ? ((double)1000000*applied)/apply_time:0)
+			  << " req/sec "
+			  << "SKIPPED = " << skipped;
+  for(int i=0;i<logs;i++) {
+    close_flash_log(scans[i].reader);
+  }
+  rdvs.clear();
+  delete[] replays;
+  delete[] quorum_finished;
+  return applied;
+}
+
+unsigned long flash_log_replay(const char **paths, 
+			       rpc_callbacks_t *callbacks)
+{
+  replay_scan_t *scans = new replay_scan_t[executor_threads];
+  for(int i=0;i<executor_threads;i++) {
+    scans[i].path = paths[i];
+    scans[i].core = i;
+  }
+  unsigned long applied = replay_logs(scans, executor_threads, callbacks);
+  delete[] scans;
+  return applied;
+}
+
+unsigned long shared_flash_log_replay(const char *path, 
+				      rpc_callbacks_t *callbacks)
+{
+  replay_scan_t scan;
+  scan.path = path;
+  scan.core = -1;
+  return replay_logs(&scan, 1, callbacks);
+}
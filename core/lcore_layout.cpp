@@ -0,0 +1,153 @@
+// Placement of raft monitors, executors and the flash logger on lcores
+#include<stdlib.h>
+#include<string.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "cyclone.hpp"
+#include "libcyclone.hpp"
+#include "cyclone_comm.hpp"
+#include "logging.hpp"
+
+extern dpdk_context_t *global_dpdk_context;
+lcore_layout_t lcore_layout;
+
+// Socket of the NIC port carrying the quorum's client requests
+static int nic_socket(int quorum)
+{
+  int queue = global_dpdk_context->ports + q_dispatcher*num_quorums + quorum;
+  int socket = rte_eth_dev_socket_id(queue2port(queue,
+						 global_dpdk_context->ports));
+  if(socket == SOCKET_ID_ANY) {
+    socket = rte_socket_id();
+  }
+  return socket;
+}
+
+static bool lcore_used[RTE_MAX_LCORE];
+
+// A free lcore on the socket, else any free lcore
+static int take_lcore(int socket, int *remote)
+{
+  unsigned int l;
+  RTE_LCORE_FOREACH_SLAVE(l) {
+    if(!lcore_used[l] && (int)rte_lcore_to_socket_id(l) == socket) {
+      lcore_used[l] = true;
+      return l;
+    }
+  }
+  RTE_LCORE_FOREACH_SLAVE(l) {
+    if(!lcore_used[l]) {
+      lcore_used[l] = true;
+      (*remote)++;
+      return l;
+    }
+  }
+  return -1;
+}
+
+static void take_explicit(std::vector<int> *map, int idx, int *lcore)
+{
+  int l = (*map)[idx];
+  if(l < 0 || l >= RTE_MAX_LCORE ||
+     !rte_lcore_is_enabled(l) ||
+     l == (int)rte_get_master_lcore() ||
+     lcore_used[l]) {
+    BOOST_LOG_TRIVIAL(fatal) << "dispatch.lcores: lcore " << l
+			     << " is not a free worker lcore";
+    exit(-1);
+  }
+  lcore_used[l] = true;
+  *lcore = l;
+}
+
+void lcore_layout_init(const char *config_quorum_path, int logger)
+{
+  boost::property_tree::ptree pt_quorum;
+  boost::property_tree::read_ini(config_quorum_path, pt_quorum);
+  std::string explicit_map = pt_quorum.get<std::string>("dispatch.lcores", "");
+  memset(lcore_used, 0, sizeof(lcore_used));
+  lcore_used[rte_get_master_lcore()] = true;
+  lcore_layout.logger = -1;
+  for(int q=0;q<num_quorums;q++) {
+    lcore_layout.quorum_socket[q] = nic_socket(q);
+  }
+  if(explicit_map.length() > 0) {
+    // Raft monitors, then executors, then the logger
+    std::vector<int> map;
+    std::stringstream ss(explicit_map);
+    std::string item;
+    while(std::getline(ss, item, ',')) {
+      map.push_back(atoi(item.c_str()));
+    }
+    int needed = num_quorums + executor_threads + (logger ? 1:0);
+    if((int)map.size() != needed) {
+      BOOST_LOG_TRIVIAL(fatal) << "dispatch.lcores lists " << map.size()
+			       << " lcores, need " << needed;
+      exit(-1);
+    }
+    int idx = 0;
+    for(int q=0;q<num_quorums;q++) {
+      take_explicit(&map, idx++, &lcore_layout.raft[q]);
+    }
+    for(int i=0;i<executor_threads;i++) {
+      take_explicit(&map, idx++, &lcore_layout.executor[i]);
+    }
+    if(logger) {
+      take_explicit(&map, idx++, &lcore_layout.logger);
+    }
+  }
+  else {
+    // Each quorum's monitor and executors on the socket of its NIC port
+    int remote = 0;
+    for(int q=0;q<num_quorums;q++) {
+      int socket = lcore_layout.quorum_socket[q];
+      lcore_layout.raft[q] = take_lcore(socket, &remote);
+      for(int i=q;i<executor_threads;i+=num_quorums) {
+	lcore_layout.executor[i] = take_lcore(socket, &remote);
+      }
+    }
+    if(logger) {
+      lcore_layout.logger = take_lcore(lcore_layout.quorum_socket[0], &remote);
+    }
+    bool short_lcores = (lcore_layout.logger == -1 && logger);
+    for(int q=0;q<num_quorums;q++) {
+      short_lcores = short_lcores || lcore_layout.raft[q] == -1;
+    }
+    for(int i=0;i<executor_threads;i++) {
+      short_lcores = short_lcores || lcore_layout.executor[i] == -1;
+    }
+    if(short_lcores) {
+      BOOST_LOG_TRIVIAL(fatal) << "Need "
+			       << (1 + num_quorums + executor_threads + (logger ? 1:0))
+			       << " lcores for " << num_quorums
+			       << " quorums and " << executor_threads
+			       << " executors, have " << rte_lcore_count();
+      exit(-1);
+    }
+    if(remote > 0) {
+      BOOST_LOG_TRIVIAL(warning) << remote
+				 << " lcores placed off their NIC socket";
+    }
+  }
+  for(int q=0;q<num_quorums;q++) {
+    std::stringstream executors;
+    int remote = 0;
+    for(int i=q;i<executor_threads;i+=num_quorums) {
+      executors << " " << lcore_layout.executor[i];
+      if((int)rte_lcore_to_socket_id(lcore_layout.executor[i]) !=
+	 lcore_layout.quorum_socket[q]) {
+	remote++;
+      }
+    }
+    if((int)rte_lcore_to_socket_id(lcore_layout.raft[q]) !=
+       lcore_layout.quorum_socket[q]) {
+      remote++;
+    }
+    BOOST_LOG_TRIVIAL(info) << "Quorum " << q
+			    << " NIC socket " << lcore_layout.quorum_socket[q]
+			    << " raft lcore " << lcore_layout.raft[q]
+			    << " executor lcores" << executors.str()
+			    << " remote " << remote;
+  }
+}
@@ -21,11 +21,35 @@ static const int RAFT_NACK_TIMEOUT          = 20;
 // RAFT log tuning -- need to match load
 static const int RAFT_LOG_TARGET  = 1000;
 
-// Client side timeouts
+// Client side timeouts. Requests are retransmitted to the same server
+// on a Jacobson/Karels estimate of its RTT (RTO = SRTT + 4 RTTVAR,
+// doubled per retransmit), failover starts once a request has gone
+// unanswered for the larger of timeout_msec and rto_failover_rtos RTOs.
 static const int timeout_msec  = 30; // Client - failure detect
+static const unsigned long rto_initial_usec = 5000; // Before any sample
+// Well above commit latency (flashlog_seal_usecs), a resend of a request
+// still executing is rejected and needlessly doubles the next timeout
+static const unsigned long rto_min_usec = 2000;
+static const unsigned long rto_max_usec = 50000;
+static const int rto_failover_rtos = 4;
+// Client - wait before asking again while no leader is known
+static const unsigned int redirect_backoff_usec = 1000;
 
-// Execution resources
-static const int executor_threads = 32;
+// Execution resources -- set from the quorum config by cyclone_config_init
+static const int MAX_EXECUTOR_THREADS = 128; // See core_mask_t
+static const int MAX_QUORUMS = 16; // Executor descriptor quorum field
+static const int default_executor_threads = 32;
+extern int executor_threads;
+static const int executor_burst   = 32; // Descriptors dequeued per pass
+static const unsigned long executor_batch_report = 1000000; // Requests
+static const int executor_spec_max = 64; // Unresolved speculative requests
+static const int executor_park_max = 256; // Requests held behind a fence
+static const int barrier_fanout = 4; // Multicore rendezvous tree arity
+// Executor wait for commit: pauses, then backoff (or umwait)
+static const unsigned int spin_wait_pauses = 64;
+static const unsigned int spin_wait_backoff_max = 1024; // pauses
+static const int spin_wait_umwait = 1; // Only if cpu has WAITPKG
+static const unsigned long spin_wait_umwait_cycles = 10000;
 
 // ZMQ specific tuning
 static const int zmq_threads = 4;
@@ -34,28 +58,239 @@ static const int zmq_threads = 4;
 static const int q_raft       = 0;
 static const int q_dispatcher = 1;
 static const int num_queues   = 2;
-static const int num_quorums  = 8;
-static const int Q_BUFS = 8191;
+static const int default_num_quorums = 8;
+static const int default_q_bufs = 8191;
+extern int num_quorums;
+extern int Q_BUFS;
 static const int R_BUFS = 1023;
 
-// Maximum clients (1 million)
+// Maximum clients (1 million), servers size their tables to the
+// clients they are started with
 static const unsigned int MAX_CLIENTS = 1024U*1024U;
-static const char MAX_INFLIGHT = 1;
+// Requests in flight per client and quorum, negotiated at RPC_REQ_STABLE
+static const int credit_window_default = 1;
+static const int credit_window_max = 64;
+extern int client_window; // Asked for by clients
+static const unsigned int credit_reject_backoff_usec = 10;
+// Resends of a request a quorum has accepted are dropped until it
+// finishes. Entries of requests lost with the leadership never finish,
+// they lapse after dedup_expire_usecs.
+static const int dedup_slots = 65536; // Per quorum, power of 2
+static const int dedup_probe = 16;
+static const unsigned long dedup_expire_usecs = 1000000;
+// Asynchronous requests a client handle can track
+static const int client_async_max = 256;
 
 static int core_to_quorum(int core_id)
 {
   return core_id % num_quorums;
 }
 
+// Set of executor cores, one bit per core. Passed by value: it is
+// embedded in packed wire structures.
+static const int CORE_MASK_WORDS = (MAX_EXECUTOR_THREADS + 63)/64;
+typedef struct core_mask_st {
+  unsigned long w[CORE_MASK_WORDS];
+} core_mask_t;
+
+static core_mask_t core_mask_none()
+{
+  core_mask_t m;
+  for(int i=0;i<CORE_MASK_WORDS;i++) {
+    m.w[i] = 0;
+  }
+  return m;
+}
+
+static core_mask_t core_mask_single(int core)
+{
+  core_mask_t m = core_mask_none();
+  m.w[core >> 6] = 1UL << (core & 63);
+  return m;
+}
+
+static void core_mask_set(core_mask_t *m, int core)
+{
+  m->w[core >> 6] |= (1UL << (core & 63));
+}
+
+static int core_mask_test(core_mask_t m, int core)
+{
+  return (m.w[core >> 6] >> (core & 63)) & 1;
+}
+
+static int core_mask_empty(core_mask_t m)
+{
+  unsigned long acc = 0;
+  for(int i=0;i<CORE_MASK_WORDS;i++) {
+    acc |= m.w[i];
+  }
+  return acc == 0;
+}
+
+static int core_mask_equal(core_mask_t a, core_mask_t b)
+{
+  unsigned long diff = 0;
+  for(int i=0;i<CORE_MASK_WORDS;i++) {
+    diff |= (a.w[i] ^ b.w[i]);
+  }
+  return diff == 0;
+}
+
+static core_mask_t core_mask_or(core_mask_t a, core_mask_t b)
+{
+  for(int i=0;i<CORE_MASK_WORDS;i++) {
+    a.w[i] |= b.w[i];
+  }
+  return a;
+}
+
+static core_mask_t core_mask_and(core_mask_t a, core_mask_t b)
+{
+  for(int i=0;i<CORE_MASK_WORDS;i++) {
+    a.w[i] &= b.w[i];
+  }
+  return a;
+}
+
+static core_mask_t core_mask_andnot(core_mask_t a, core_mask_t b)
+{
+  for(int i=0;i<CORE_MASK_WORDS;i++) {
+    a.w[i] &= ~b.w[i];
+  }
+  return a;
+}
+
+static int core_mask_count(core_mask_t m)
+{
+  int count = 0;
+  for(int i=0;i<CORE_MASK_WORDS;i++) {
+    count += __builtin_popcountl(m.w[i]);
+  }
+  return count;
+}
+
+// More than one core, the request needs a rendezvous
+static int core_mask_is_multi(core_mask_t m)
+{
+  return core_mask_count(m) > 1;
+}
+
+// Lowest core in the mask at or after core 'from', -1 if none
+static int core_mask_next(core_mask_t m, int from)
+{
+  int i = from >> 6;
+  if(i >= CORE_MASK_WORDS) {
+    return -1;
+  }
+  unsigned long word = m.w[i] & (~0UL << (from & 63));
+  while(word == 0) {
+    if(++i == CORE_MASK_WORDS) {
+      return -1;
+    }
+    word = m.w[i];
+  }
+  return (i << 6) + __builtin_ctzl(word);
+}
+
+// Lowest core in the mask (the leader of a multicore request), -1 if none
+static int core_mask_first(core_mask_t m)
+{
+  return core_mask_next(m, 0);
+}
+
+#define for_each_core(c, m)					\
+  for(int c = core_mask_first(m); c != -1; c = core_mask_next(m, c + 1))
+
+// Shared masks updated concurrently: an array of CORE_MASK_WORDS words
+static void core_mask_atomic_set(volatile unsigned long *words, int core)
+{
+  __sync_fetch_and_or(&words[core >> 6], 1UL << (core & 63));
+}
+
+static void core_mask_atomic_or(volatile unsigned long *words, core_mask_t m)
+{
+  for(int i=0;i<CORE_MASK_WORDS;i++) {
+    if(m.w[i] != 0) {
+      __sync_fetch_and_or(&words[i], m.w[i]);
+    }
+  }
+}
+
+static int core_mask_atomic_equal(volatile unsigned long *words,
+				  core_mask_t m)
+{
+  unsigned long diff = 0;
+  for(int i=0;i<CORE_MASK_WORDS;i++) {
+    diff |= (words[i] ^ m.w[i]);
+  }
+  return diff == 0;
+}
+
+static void core_mask_atomic_clear(volatile unsigned long *words)
+{
+  for(int i=0;i<CORE_MASK_WORDS;i++) {
+    words[i] = 0;
+  }
+}
+
+static core_mask_t all_cores_mask()
+{
+  core_mask_t m = core_mask_none();
+  for(int i=0;i<CORE_MASK_WORDS;i++) {
+    int bits = executor_threads - (i << 6);
+    if(bits >= 64) {
+      m.w[i] = ~0UL;
+    }
+    else if(bits > 0) {
+      m.w[i] = (1UL << bits) - 1;
+    }
+  }
+  return m;
+}
+
+// Logical partitions, each owned by one executor core (and so by that
+// core's quorum). Versioned: moving a partition bumps the version and
+// clients routing by an older map are told to refetch it.
+static const int MAX_PARTITIONS = 1024;
+typedef struct partition_map_st {
+  unsigned int version;
+  int partitions;
+  unsigned char core[MAX_PARTITIONS];
+} partition_map_t;
+// Boot map, on servers then the live one kept in the dispatcher state
+// (read it through the seqlock in cyclone.hpp)
+extern partition_map_t partition_map;
+
+// Bytes of the map on the wire, only the used entries
+static int partition_map_size(const partition_map_t *map)
+{
+  return 2*sizeof(int) + map->partitions;
+}
+
+// Load executor_threads, num_quorums, Q_BUFS, rocksdb_num_threads,
+// client_window and partition_map from the [dispatch] section of the
+// quorum config (executors, quorums, q_bufs, rocksdb_threads,
+// client_window, partitions, partition_map), keeping the defaults for
+// absent keys. partition_map lists the core of each partition, partition
+// p defaults to core p % executors. Servers must call it before
+// cyclone_network_init, dispatcher_start and cyclone_client_init call it
+// too. Only the first call has effect.
+void cyclone_config_init(const char *config_quorum_path);
+
 
 /////////////////////////////////
 
 typedef struct rpc_cookie_st {
   int core_id;
-  unsigned long core_mask;
+  core_mask_t core_mask;
   int log_idx;
   void *ret_value;
   int ret_size;
+  void *reply_mbuf; // Internal, see rpc_reply_buffer
+  int speculative; // Executed before commit, see spec_commit_callback
+  int single_exec; // Runs alone for every core in core_mask
+  int ret_code; // Result code of an op in a RPC_FLAG_BATCH request
 } rpc_cookie_t;
 
 ////// RPC Server side interface
@@ -71,14 +306,48 @@ int (*flashlog_callback_t)(const unsigned char *data,
 			   const int len,
 			   rpc_cookie_t *rpc_cookie);
 
-//Garbage collect return value
+//Garbage collect return value, may be NULL if all
+//return values come from rpc_reply_buffer
 typedef void (*rpc_gc_callback_t)(rpc_cookie_t *cookie);
 
+// Called from an rpc callback: returns a writable size byte reply
+// buffer in place inside the outgoing response packet and sets
+// cookie->ret_value/ret_size to it. No copy or free is needed, the
+// buffer is released once the reply is sent (or dropped). Ops of a
+// batch, and replies while the mbuf pool is exhausted, get executor
+// scratch space instead.
+void* rpc_reply_buffer(rpc_cookie_t *cookie, int size);
+
+// Optional, called periodically by an idle executor to let its flash log
+// seal and reap (see log_poll). Returns currently checkpointed log idx
+typedef int (*flashlog_poll_callback_t)(rpc_cookie_t *rpc_cookie);
+
+// Optional, executes count committed requests in log order. Replaces
+// rpc_callback for single core read-write requests, each request gets
+// its own cookie (and gc_callback call) as with rpc_callback
+typedef void (*rpc_batch_callback_t)(const unsigned char **data,
+				     const int *len,
+				     rpc_cookie_t *cookies,
+				     int count);
+
+// Optional speculative execution, both must be set to enable it.
+// Single core read-write requests are passed to rpc_callback as soon
+// as they are logged locally, before commit, with the reply held back.
+// Requests then resolve in log order: spec_commit once committed, or
+// spec_abort (newest first) to undo requests when an entry is dropped,
+// after which requests still in the log are executed again.
+// Other requests only run after all speculative ones have resolved.
+typedef void (*rpc_spec_callback_t)(rpc_cookie_t *cookie);
+
 // Callbacks structure
 typedef struct rpc_callbacks_st {
   rpc_callback_t rpc_callback;
-  rpc_gc_callback_t gc_callback;
+  rpc_gc_callback_t gc_callback; // NULL if replies use rpc_reply_buffer
   flashlog_callback_t flashlog_callback;
+  flashlog_poll_callback_t flashlog_poll_callback;
+  rpc_batch_callback_t rpc_batch_callback; // Unused when speculating
+  rpc_spec_callback_t spec_commit_callback;
+  rpc_spec_callback_t spec_abort_callback;
 } rpc_callbacks_t;
 
 // Init network stack
@@ -87,6 +356,18 @@ void cyclone_network_init(const char *config_cluster_path,
 			  int me_mc,
 			  int queues);
 
+// Offload flash logging to a dedicated lcore after the executors.
+// logs[i] (from create_flash_log) receives executor i's records
+// instead of flashlog_callback being called. Call before dispatcher_start.
+static const int flashlog_offload_batch = 32; // Per executor per pass
+void dispatcher_flashlog_offload(void **logs);
+
+// Declare that the application's reads don't depend on which executor
+// runs them. Single core RO requests flagged RPC_FLAG_ANYCORE then go to
+// a ring shared by the quorum's executors, drained by whichever has
+// spare room in its burst. Call before dispatcher_start.
+void dispatcher_ro_anycore();
+
 // Start the dispatcher loop -- note: does not return
 void dispatcher_start(const char* config_cluster_path,
 		      const char* config_quorum_path,
@@ -107,32 +388,176 @@ int make_rpc(void *handle,
 	     void *payload,
 	     int sz,
 	     void **response,
-	     unsigned long core_mask,
+	     core_mask_t core_mask,
 	     int rpc_flags);
 
-int delete_node(void *handle, unsigned long core_mask, int node);
+// Requests the server lets this client have in flight per quorum
+// (dispatch.client_window, capped by the server)
+int cyclone_client_credits(void *handle);
+
+// Make an rpc call on a logical partition, routed to its core by the
+// client's copy of the partition map -- returns size of response
+int make_rpc_partition(void *handle,
+		       void *payload,
+		       int sz,
+		       void **response,
+		       int partition,
+		       int rpc_flags);
+
+// Partitions in the client's map
+int cyclone_partitions(void *handle);
+
+// Completion of an asynchronous rpc
+typedef struct rpc_completion_st {
+  void *tag;      // As passed when making the call
+  void *response; // Valid until the next cyclone_poll on the handle
+  int size;
+} rpc_completion_t;
+
+// Send an rpc without waiting for the reply, it completes through
+// cyclone_poll. Returns -1 if the handle already has its credit window
+// in flight on the quorum (or client_async_max in all), poll and retry.
+// Don't mix with the blocking calls on the same handle.
+int make_rpc_async(void *handle,
+		   void *payload,
+		   int sz,
+		   core_mask_t core_mask,
+		   int rpc_flags,
+		   void *tag);
 
-int add_node(void *handle, unsigned long core_mask, int node);
+int make_rpc_partition_async(void *handle,
+			     void *payload,
+			     int sz,
+			     int partition,
+			     int rpc_flags,
+			     void *tag);
+
+// Collect up to max completed asynchronous rpcs without blocking,
+// resending rejected ones and all of them if one times out (after
+// looking for a new leader). Returns the number collected.
+int cyclone_poll(void *handle, rpc_completion_t *completions, int max);
+
+// Move a partition to another core online. Requests already logged
+// for it on the old core run there first. Returns 0 once the map has
+// it on the core, -1 if the partition or core is out of range.
+int cyclone_remap_partition(void *handle, int partition, int core);
+
+int delete_node(void *handle, core_mask_t core_mask, int node);
+
+int add_node(void *handle, core_mask_t core_mask, int node);
 
 
 // Possible flags 
 static const int RPC_FLAG_RO            = 1; // Read-only RPC
+// With RPC_FLAG_RO, any executor of the quorum may run it (requires
+// dispatcher_ro_anycore on the server, ignored otherwise)
+static const int RPC_FLAG_ANYCORE       = 2;
+// Multicore only: the lowest core in the mask runs the request alone once
+// every other core has reached it, those go on executing and only fence
+// their partition until it is done (see rpc_cookie_t single_exec)
+static const int RPC_FLAG_SINGLE_EXEC   = 4;
+// Payload is a batch of ops, each passed to rpc_callback with its own
+// cookie and answered with its own result (see cyclone_batch_init)
+static const int RPC_FLAG_BATCH         = 8;
+// With RPC_FLAG_BATCH, hand all ops to rpc_batch_callback in one call
+// so the application can apply them as a unit. Servers without one
+// apply none and answer every op with BATCH_OP_NOT_ATOMIC.
+static const int RPC_FLAG_BATCH_ATOMIC  = 16;
+
+// Batch wire format: op count, then each op as its size and bytes. The
+// reply holds the op count, then each op's code, size and bytes.
+static const int batch_max_ops = 64;
+static const unsigned long batch_flush_usecs = 50; // Oldest op's wait
+static const int BATCH_OP_TRUNCATED = -1; // Result did not fit the reply
+static const int BATCH_OP_NOT_ATOMIC = -2; // Not applied, see above
+typedef struct batch_op_st {
+  int size;
+} __attribute__((packed)) batch_op_t;
+typedef struct batch_result_hdr_st {
+  int code;
+  int size;
+} __attribute__((packed)) batch_result_hdr_t;
+
+typedef struct rpc_batch_result_st {
+  int code; // cookie->ret_code from the server, or a BATCH_OP_ code
+  void *data;
+  int size;
+} rpc_batch_result_t;
+
+// Client side batch of ops for one core, or for a partition if
+// partition >= 0. rpc_flags may add RPC_FLAG_RO, RPC_FLAG_BATCH_ATOMIC.
+void* cyclone_batch_init(void *handle,
+			 core_mask_t core_mask,
+			 int partition,
+			 int rpc_flags);
+
+// Queue an op, returns its index in the batch or -1 if the batch is
+// full: flush and add it again
+int cyclone_batch_add(void *batch, const void *op, int sz);
+
+// Whether the batch is full or its oldest op has waited batch_flush_usecs
+int cyclone_batch_due(void *batch);
+
+// Send the queued ops as one rpc and wait for it. Fills in a result per
+// op, valid until the next call on the client handle, returns their count.
+int cyclone_batch_flush(void *batch, rpc_batch_result_t *results);
 
 
 ////// RocksDB parameters
-const int rocksdb_num_threads           = 16;
+static const int default_rocksdb_num_threads = 16;
+extern int rocksdb_num_threads;
 
 
 
 /////////////////// Flash log interfaces /////////////////////
 static const int flashlog_pagesize = (128*1024);
-static const int flashlog_hwm = 200;
+static const int flashlog_hwm = 200; // Initial, adapts to arrival rate
+static const int flashlog_hwm_min = 16;
+static const int flashlog_hwm_max = 4096;
+static const unsigned long flashlog_seal_usecs = 500; // Max page age
+static const int flashlog_rate_ewma = 8;
+static const int flashlog_pipeline = 8; // Ring of pages, all but one in flight
 static const int flashlog_use_osync = 0;
+static const int flashlog_compress = 0; // zstd compress sealed pages
+static const int flashlog_compress_level = 1;
+static const unsigned long flashlog_compress_report = 100000; // Pages
 static const unsigned long flashlog_segsize   =  (1024*1024*1024);
+static const unsigned int flashlog_spare_segments = 2; // Per log
 void *create_flash_log(const char *path);
+// Reap completed writes without blocking and seal the active page if
+// older than flashlog_seal_usecs, returns checkpointed log idx
+int log_poll(void *log);
+// Segments holding only raft idx < raft_idx may be recycled
+void flash_log_truncate(void *log, int raft_idx);
+// One log shared by writers (executors), returns checkpointed log idx
+// for the calling writer. Not for use with flash_log_truncate.
+static const int flashlog_shared_hwm = 1024;
+void *create_shared_flash_log(const char *path, int writers);
+int shared_log_append(void *log,
+		      int writer,
+		      const char *data, 
+		      int size,
+		      int raft_idx);
+int shared_log_poll(void *log, int writer);
 int log_append(void *log_, 
 	       const char *data, 
 	       int size,
 	       int raft_idx);
+// Sequential reader, returns 0 at end of log
+void *open_flash_log(const char *path);
+int flash_log_read(void *reader,
+		   const unsigned char **data,
+		   int *size,
+		   int *raft_idx);
+void close_flash_log(void *reader);
+// Replay per-executor logs (paths[i] written by executor i) through
+// rpc_batch_callback, flashlog_replay_batch requests at a time, or
+// rpc_callback if it is NULL, then gc_callback. Returns number of
+// requests applied
+static const int flashlog_replay_batch = 256;
+unsigned long flash_log_replay(const char **paths, 
+			       rpc_callbacks_t *callbacks);
+unsigned long shared_flash_log_replay(const char *path, 
+				      rpc_callbacks_t *callbacks);
 
 #endif
@@ -0,0 +1,86 @@
+#ifndef _SPIN_WAIT_
+#define _SPIN_WAIT_
+// Bounded spin for a shared word to change: pause, then exponential
+// backoff, or umonitor/umwait where the CPU has WAITPKG
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <rte_cycles.h>
+#include "libcyclone.hpp"
+
+static int waitpkg_available()
+{
+  static int available = -1;
+  if(available == -1) {
+    unsigned int eax, ebx, ecx, edx;
+    available = 0;
+    if(__get_cpuid_max(0, NULL) >= 7) {
+      __cpuid_count(7, 0, eax, ebx, ecx, edx);
+      available = (ecx >> 5) & 1;
+    }
+  }
+  return available;
+}
+
+// Encoded by hand, older assemblers don't know WAITPKG
+static void cpu_umonitor(volatile void *addr)
+{
+  asm volatile(".byte 0xf3, 0x0f, 0xae, 0xf0" // umonitor %rax
+	       :
+	       : "a"(addr)
+	       : "memory");
+}
+
+static void cpu_umwait(unsigned long deadline)
+{
+  unsigned int ctrl = 1; // C0.1, faster wakeup
+  asm volatile(".byte 0xf2, 0x0f, 0xae, 0xf1" // umwait %ecx
+	       :
+	       : "c"(ctrl), "a"((unsigned int)deadline),
+		 "d"((unsigned int)(deadline >> 32))
+	       : "memory", "cc");
+}
+
+typedef struct spin_wait_st {
+  unsigned int spins;
+  unsigned int backoff;
+} spin_wait_t;
+
+static void spin_wait_init(spin_wait_t *w)
+{
+  w->spins   = 0;
+  w->backoff = 1;
+}
+
+// One step of waiting for *addr to change from val
+static void spin_wait_step(spin_wait_t *w, volatile int *addr, int val)
+{
+  if(w->spins < spin_wait_pauses) {
+    w->spins++;
+    _mm_pause();
+    return;
+  }
+  if(spin_wait_umwait && waitpkg_available()) {
+    cpu_umonitor(addr);
+    if(*addr == val) {
+      cpu_umwait(rte_get_tsc_cycles() + spin_wait_umwait_cycles);
+    }
+    return;
+  }
+  for(unsigned int i=0;i<w->backoff;i++) {
+    _mm_pause();
+  }
+  if(w->backoff < spin_wait_backoff_max) {
+    w->backoff = w->backoff << 1;
+  }
+}
+
+static void spin_wait_while(volatile int *addr, int val)
+{
+  spin_wait_t w;
+  spin_wait_init(&w);
+  while(*addr == val) {
+    spin_wait_step(&w, addr, val);
+  }
+}
+
+#endif
@@ -88,6 +88,16 @@ int driver(void *arg)
     payload = atol(payload_env);
   }
   BOOST_LOG_TRIVIAL(info) << "PAYLOAD = " << payload;
+  // Requests kept in flight with the asynchronous interface, 0 to make
+  // blocking calls
+  int pipeline = 0;
+  const char *pipeline_env = getenv("PIPELINE");
+  if(pipeline_env != NULL) {
+    pipeline = atoi(pipeline_env);
+  }
+  BOOST_LOG_TRIVIAL(info) << "PIPELINE = " << pipeline;
+  rpc_completion_t completions[client_async_max];
+  int inflight = 0;
 
   total_latency = 0;
   tx_block_cnt  = 0;
@@ -99,16 +109,37 @@ int driver(void *arg)
     rpc_flags = 0;
     //rpc_flags = RPC_FLAG_RO;
     my_core = dargs->me % executor_threads;
-    sz = make_rpc(handles[0],
-		  buffer,
-		  payload,
-		  (void **)&resp,
-		  1UL << my_core,
-		  rpc_flags);
-    if(sz != payload) {
-      BOOST_LOG_TRIVIAL(fatal) << "Invalid response";
+    if(pipeline > 0) {
+      while(inflight < pipeline &&
+	    make_rpc_async(handles[0],
+			   buffer,
+			   payload,
+			   core_mask_single(my_core),
+			   rpc_flags,
+			   NULL) == 0) {
+	inflight++;
+      }
+      int done = cyclone_poll(handles[0], completions, client_async_max);
+      for(int i=0;i<done;i++) {
+	if(completions[i].size != payload) {
+	  BOOST_LOG_TRIVIAL(fatal) << "Invalid response";
+	}
+      }
+      inflight     -= done;
+      tx_block_cnt += done;
+    }
+    else {
+      sz = make_rpc(handles[0],
+		    buffer,
+		    payload,
+		    (void **)&resp,
+		    core_mask_single(my_core),
+		    rpc_flags);
+      if(sz != payload) {
+	BOOST_LOG_TRIVIAL(fatal) << "Invalid response";
+      }
+      tx_block_cnt++;
     }
-    tx_block_cnt++;
     
     if(dargs->leader) {
       if(tx_block_cnt > 5000) {
@@ -60,12 +60,16 @@ typedef struct driver_args_st {
   }
 } driver_args_t;
 
-unsigned long gen_core_mask(int active)
+// ACTIVE_SWEEP=1: the leader steps the number of participating cores
+// through 1, 2, 4 .. executor_threads, one report block each, to chart
+// rendezvous cost against fan-in
+static volatile int sweep_active = 0;
+
+core_mask_t gen_core_mask(int active)
 {
-  unsigned long mask = 0;
-  while(__builtin_popcountl(mask) != active) {
-    int bit = rand() % executor_threads;
-    mask = mask | (1UL << bit);
+  core_mask_t mask = core_mask_none();
+  while(core_mask_count(mask) != active) {
+    core_mask_set(&mask, rand() % executor_threads);
   }
   return mask;
 }
@@ -106,6 +110,15 @@ int driver(void *arg)
   }
   BOOST_LOG_TRIVIAL(info) << "ACTIVE = " << active;
 
+  int sweep = 0;
+  const char *sweep_env = getenv("ACTIVE_SWEEP");
+  if(sweep_env != NULL) {
+    sweep = atoi(sweep_env);
+  }
+  if(sweep && dargs->leader) {
+    sweep_active = 1;
+  }
+
   total_latency = 0;
   tx_block_cnt  = 0;
   tx_block_begin = rtc_clock::current_time();
@@ -116,7 +129,11 @@ int driver(void *arg)
     rpc_flags = 0;
     //rpc_flags = RPC_FLAG_RO;
     //    my_core = dargs->me % executor_threads;
-    unsigned long core_mask = gen_core_mask(active);
+    if(sweep) {
+      while(sweep_active == 0);
+      active = sweep_active;
+    }
+    core_mask_t core_mask = gen_core_mask(active);
     //core_mask = 1UL | (1UL << 1);
     //core_mask = gen_core_mask(2);
     sz = make_rpc(handles[0],
@@ -133,12 +150,24 @@ int driver(void *arg)
     if(dargs->leader) {
       if(tx_block_cnt > 5000) {
 	total_latency = (rtc_clock::current_time() - tx_begin_time);
-	BOOST_LOG_TRIVIAL(info) << "LOAD = "
+	BOOST_LOG_TRIVIAL(info) << "ACTIVE = "
+				<< active
+				<< " LOAD = "
 				<< ((double)1000000*tx_block_cnt)/total_latency
 				<< " tx/sec "
 				<< "LATENCY = "
 				<< ((double)total_latency)/tx_block_cnt
 				<< " us ";
+	if(sweep) {
+	  int next = 2*sweep_active;
+	  if(sweep_active == executor_threads) {
+	    next = 1;
+	  }
+	  else if(next > executor_threads) {
+	    next = executor_threads;
+	  }
+	  sweep_active = next;
+	}
 	tx_begin_time = rtc_clock::current_time();
 	tx_block_cnt   = 0;
 	total_latency  = 0;
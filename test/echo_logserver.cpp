@@ -46,16 +46,13 @@
 static unsigned long *marks;
 static unsigned long *completions;
 
-static void *logs[executor_threads];
+static void *logs[MAX_EXECUTOR_THREADS];
 
 void callback(const unsigned char *data,
 	      const int len,
 	      rpc_cookie_t *cookie)
 {
-  cookie->ret_value  = NULL;
-  cookie->ret_size   = 0;
-  cookie->ret_value  = malloc(len);
-  cookie->ret_size   = len;
+  rpc_reply_buffer(cookie, len);
   memcpy(cookie->ret_value, data, len);
   /*
   if((++completions[cookie->core_id]) >= 1000000) {
@@ -79,15 +76,16 @@ int wal_callback(const unsigned char *data,
   return idx;
 }
 
-void gc(rpc_cookie_t *cookie)
+int wal_poll(rpc_cookie_t *cookie)
 {
-  free(cookie->ret_value);
+  return log_poll(logs[cookie->core_id]);
 }
 
 rpc_callbacks_t rpc_callbacks =  {
   callback,
-  gc,
-  wal_callback
+  NULL,
+  wal_callback,
+  wal_poll
 };
 
 int main(int argc, char *argv[])
@@ -96,6 +94,7 @@ int main(int argc, char *argv[])
     printf("Usage1: %s replica_id replica_mc clients cluster_config quorum_config ports\n", argv[0]);
     exit(-1);
   }
+  cyclone_config_init(argv[5]);
   marks       = (unsigned long *)malloc(executor_threads*sizeof(unsigned long));
   completions = (unsigned long *)malloc(executor_threads*sizeof(unsigned long));
   memset(marks, 0, executor_threads*sizeof(unsigned long));
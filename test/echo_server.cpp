@@ -51,10 +51,7 @@ void callback(const unsigned char *data,
 	      const int len,
 	      rpc_cookie_t *cookie)
 {
-  cookie->ret_value  = NULL;
-  cookie->ret_size   = 0;
-  cookie->ret_value  = malloc(len);
-  cookie->ret_size   = len;
+  rpc_reply_buffer(cookie, len);
   memcpy(cookie->ret_value, data, len);
   /*
   if((++completions[cookie->core_id]) >= 1000000) {
@@ -74,14 +71,9 @@ int wal_callback(const unsigned char *data,
   return cookie->log_idx;
 }
 
-void gc(rpc_cookie_t *cookie)
-{
-  free(cookie->ret_value);
-}
-
 rpc_callbacks_t rpc_callbacks =  {
   callback,
-  gc,
+  NULL,
   wal_callback
 };
 
@@ -91,6 +83,7 @@ int main(int argc, char *argv[])
     printf("Usage1: %s replica_id replica_mc clients cluster_config quorum_config ports\n", argv[0]);
     exit(-1);
   }
+  cyclone_config_init(argv[5]);
   marks       = (unsigned long *)malloc(executor_threads*sizeof(unsigned long));
   completions = (unsigned long *)malloc(executor_threads*sizeof(unsigned long));
   memset(marks, 0, executor_threads*sizeof(unsigned long));
@@ -81,9 +81,21 @@ int driver(void *arg)
   unsigned long tx_block_begin = rtc_clock::current_time();
   unsigned long total_latency  = 0;
   int rpc_flags;
-  int my_core;
   fb_kv_t *kv = (fb_kv_t *)buffer;
   load_gen test(dargs->me);
+  // Pack ops for a partition into one request, reads and writes apart
+  bool batching = (getenv("FB_BATCH") != NULL);
+  int map_partitions = cyclone_partitions(handles[0]);
+  void **ro_batches = new void *[map_partitions];
+  void **rw_batches = new void *[map_partitions];
+  rpc_batch_result_t results[batch_max_ops];
+  for(int p=0;p<map_partitions && batching;p++) {
+    ro_batches[p] = cyclone_batch_init(handles[0], 
+				       core_mask_none(), 
+				       p, 
+				       RPC_FLAG_RO);
+    rw_batches[p] = cyclone_batch_init(handles[0], core_mask_none(), p, 0);
+  }
 
   total_latency = 0;
   tx_block_cnt  = 0;
@@ -106,14 +118,32 @@ int driver(void *arg)
     }
     kv->key   = ((unsigned long)idx) << 56;
     kv->key   = kv->key + test.gen_key(idx);
-    my_core = kv->key % executor_threads;
-    sz = make_rpc(handles[0],
-		  buffer,
-		  sz,
-		  (void **)&resp,
-		  1UL << my_core,
-		  rpc_flags);
-    tx_block_cnt++;
+    partition = kv->key % map_partitions;
+    if(batching) {
+      void *batch = (rpc_flags & RPC_FLAG_RO) ? 
+	ro_batches[partition]:rw_batches[partition];
+      if(cyclone_batch_add(batch, buffer, sz) == -1) {
+	tx_block_cnt += cyclone_batch_flush(batch, results);
+	cyclone_batch_add(batch, buffer, sz);
+      }
+      for(int p=0;p<map_partitions;p++) {
+	if(cyclone_batch_due(ro_batches[p])) {
+	  tx_block_cnt += cyclone_batch_flush(ro_batches[p], results);
+	}
+	if(cyclone_batch_due(rw_batches[p])) {
+	  tx_block_cnt += cyclone_batch_flush(rw_batches[p], results);
+	}
+      }
+    }
+    else {
+      sz = make_rpc_partition(handles[0],
+			      buffer,
+			      sz,
+			      (void **)&resp,
+			      partition,
+			      rpc_flags);
+      tx_block_cnt++;
+    }
     
     if(dargs->leader) {
       if(tx_block_cnt > 5000) {
@@ -51,29 +51,30 @@
 static unsigned long *marks;
 static unsigned long *completions;
 rocksdb::DB* db = NULL;
-static void *logs[executor_threads];
+static void *logs[MAX_EXECUTOR_THREADS];
 
 typedef struct batch_barrier_st {
-  volatile unsigned long batch_barrier[2];
+  volatile unsigned long batch_barrier[2][CORE_MASK_WORDS];
   volatile int batch_barrier_sense;
 } batch_barrier_t;
 
-static batch_barrier_t barriers[executor_threads];
+static batch_barrier_t barriers[MAX_EXECUTOR_THREADS];
 
 static void barrier(batch_barrier_t *barrier,
 		    int thread_id, 
-		    unsigned long mask, 
+		    core_mask_t mask, 
 		    bool leader)
 {
   int sense = barrier->batch_barrier_sense;
-  __sync_fetch_and_or(&barrier->batch_barrier[sense], 1UL << thread_id);
+  core_mask_atomic_set(barrier->batch_barrier[sense], thread_id);
   if(leader) {
-    while(barrier->batch_barrier[sense] != mask);
+    while(!core_mask_atomic_equal(barrier->batch_barrier[sense], mask));
     barrier->batch_barrier_sense  = 1 - barrier->batch_barrier_sense;
-    barrier->batch_barrier[sense] = 0;
+    core_mask_atomic_clear(barrier->batch_barrier[sense]);
   }
   else {
-    while(barrier->batch_barrier[sense] != 0);
+    while(!core_mask_atomic_equal(barrier->batch_barrier[sense],
+				  core_mask_none()));
   }
 }
 
@@ -102,8 +103,7 @@ void callback(const unsigned char *data,
       BOOST_LOG_TRIVIAL(fatal) << s.ToString();
       exit(-1);
     }
-    cookie->ret_value  = malloc(sizeof(fb_kv_t));
-    cookie->ret_size   = sizeof(fb_kv_t);
+    rpc_reply_buffer(cookie, sizeof(fb_kv_t));
     fb_kv_t *rock_back = (fb_kv_t *)cookie->ret_value;
     rock_back->key = request->key;
   }
@@ -114,14 +114,12 @@ void callback(const unsigned char *data,
 				key,
 				&value);
     if(s.IsNotFound()) {
-      cookie->ret_value  = malloc(sizeof(fb_kv_t));
-      cookie->ret_size   = sizeof(fb_kv_t);
+      rpc_reply_buffer(cookie, sizeof(fb_kv_t));
       fb_kv_t *rock_back = (fb_kv_t *)cookie->ret_value;
       rock_back->key = ULONG_MAX;
     }
     else {
-      cookie->ret_value  = malloc(sizeof(fb_kv_t) + value.length());
-      cookie->ret_size   = sizeof(fb_kv_t) + value.length();
+      rpc_reply_buffer(cookie, sizeof(fb_kv_t) + value.length());
       fb_kv_t *rock_back = (fb_kv_t *)cookie->ret_value;
       rock_back->key = request->key;
       memcpy(rock_back + 1, value.c_str(), value.length());
@@ -155,14 +153,9 @@ int wal_callback(const unsigned char *data,
   }
 }
 
-void gc(rpc_cookie_t *cookie)
-{
-  free(cookie->ret_value);
-}
-
 rpc_callbacks_t rpc_callbacks =  {
   callback,
-  gc,
+  NULL,
   wal_callback
 };
 
@@ -194,13 +187,14 @@ int main(int argc, char *argv[])
     printf("Usage1: %s replica_id replica_mc clients cluster_config quorum_config ports\n", argv[0]);
     exit(-1);
   }
+  cyclone_config_init(argv[5]);
   marks       = (unsigned long *)malloc(executor_threads*sizeof(unsigned long));
   completions = (unsigned long *)malloc(executor_threads*sizeof(unsigned long));
   memset(marks, 0, executor_threads*sizeof(unsigned long));
   memset(completions, 0, executor_threads*sizeof(unsigned long));
   for(int i=0;i<executor_threads;i++) {
-    barriers[i].batch_barrier[0] = 0;
-    barriers[i].batch_barrier[1] = 0;
+    core_mask_atomic_clear(barriers[i].batch_barrier[0]);
+    core_mask_atomic_clear(barriers[i].batch_barrier[1]);
     barriers[i].batch_barrier_sense = 0;
   }
   int server_id = atoi(argv[1]);
@@ -0,0 +1,44 @@
+// Measure log_append cost and the share of it spent on checksums
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<libcyclone.hpp>
+#include "../core/logging.hpp"
+#include "../core/clock.hpp"
+#include "../core/crc32c.hpp"
+
+int main(int argc, char *argv[])
+{
+  if(argc != 4) {
+    printf("Usage: %s log_path record_bytes records\n", argv[0]);
+    exit(-1);
+  }
+  int size = atoi(argv[2]);
+  unsigned long records = atol(argv[3]);
+  char *data = (char *)malloc(size);
+  for(int i=0;i<size;i++) {
+    data[i] = (char)rand();
+  }
+  void *log = create_flash_log(argv[1]);
+  unsigned long mark = rtc_clock::current_time();
+  for(unsigned long i=0;i<records;i++) {
+    log_append(log, data, size, (int)i);
+  }
+  unsigned long append_time = rtc_clock::current_time() - mark;
+  volatile unsigned int sink = 0;
+  mark = rtc_clock::current_time();
+  for(unsigned long i=0;i<records;i++) {
+    sink += crc32c(data, size);
+  }
+  unsigned long crc_time = rtc_clock::current_time() - mark;
+  BOOST_LOG_TRIVIAL(info) << "log_append "
+			  << ((double)append_time*1000)/records
+			  << " ns/record "
+			  << "crc32c "
+			  << ((double)crc_time*1000)/records
+			  << " ns/record "
+			  << "OVERHEAD = "
+			  << (append_time ? (100.0*crc_time)/append_time:0)
+			  << "%";
+  return 0;
+}
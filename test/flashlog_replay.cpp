@@ -0,0 +1,157 @@
+// Rebuild rocksdb state from the per-executor flash logs
+
+
+#include<assert.h>
+#include<errno.h>
+#include<libcyclone.hpp>
+#include<string.h>
+#include<stdlib.h>
+#include "../core/logging.hpp"
+#include "../core/clock.hpp"
+#include<stdio.h>
+#include <time.h>
+#include<unistd.h>
+#include <rocksdb/db.h>
+#include <rocksdb/options.h>
+#include "rocksdb.hpp"
+#include <rocksdb/write_batch.h>
+
+rocksdb::DB* db = NULL;
+
+static void add_puts(rocksdb::WriteBatch *batch,
+		     const unsigned char *data,
+		     const int len)
+{
+  rock_kv_t *rock = (rock_kv_t *)data;
+  if(rock->op != OP_PUT) {
+    return;
+  }
+  int bytes  = len;
+  const unsigned char *buffer = data;
+  while(bytes) {
+    if(bytes == len) {
+      rocksdb::Slice key((const char *)&rock->key, 8);
+      rocksdb::Slice value((const char *)&rock->value[0], value_sz);
+      batch->Put(key, value);
+      buffer = buffer + sizeof(rock_kv_t);
+      bytes -= sizeof(rock_kv_t);
+    }
+    else {
+      rock_kv_pair_t *kv = (rock_kv_pair_t *)buffer;
+      rocksdb::Slice key((const char *)&kv->key, 8);
+      rocksdb::Slice value((const char *)&kv->value[0], value_sz);
+      batch->Put(key, value);
+      buffer = buffer + sizeof(rock_kv_pair_t);
+      bytes -= sizeof(rock_kv_pair_t);
+    }
+  }
+}
+
+static void write_batch(rocksdb::WriteBatch *batch)
+{
+  rocksdb::WriteOptions write_options;
+  write_options.sync       = false;
+  write_options.disableWAL = true;
+  rocksdb::Status s = db->Write(write_options, batch);
+  if (!s.ok()){
+    BOOST_LOG_TRIVIAL(fatal) << s.ToString();
+    exit(-1);
+  }
+}
+
+void callback(const unsigned char *data,
+	      const int len,
+	      rpc_cookie_t *cookie)
+{
+  rocksdb::WriteBatch batch;
+  add_puts(&batch, data, len);
+  if(batch.Count() > 0) {
+    write_batch(&batch);
+  }
+}
+
+// One write for a whole replay batch
+void batch_callback(const unsigned char **data,
+		    const int *len,
+		    rpc_cookie_t *cookies,
+		    int count)
+{
+  rocksdb::WriteBatch batch;
+  for(int i=0;i<count;i++) {
+    add_puts(&batch, data[i], len[i]);
+  }
+  if(batch.Count() > 0) {
+    write_batch(&batch);
+  }
+}
+
+void gc(rpc_cookie_t *cookie)
+{
+  free(cookie->ret_value);
+}
+
+rpc_callbacks_t rpc_callbacks =  {
+  callback,
+  gc,
+  NULL,
+  NULL,
+  batch_callback
+};
+
+void opendb(){
+  rocksdb::Options options;
+  int num_threads=rocksdb_num_threads;
+  options.create_if_missing = true;
+  options.write_buffer_size = 1024 * 1024 * 256;
+  options.target_file_size_base = 1024 * 1024 * 512;
+  options.IncreaseParallelism(num_threads);
+  options.max_background_compactions = num_threads;
+  options.max_background_flushes = num_threads;
+  options.max_write_buffer_number = num_threads;
+  options.wal_dir = log_dir;
+  rocksdb::Status s = rocksdb::DB::Open(options, data_dir, &db);
+  if (!s.ok()){
+    BOOST_LOG_TRIVIAL(fatal) << s.ToString().c_str();
+    exit(-1);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  if(argc > 3) {
+    printf("Usage: %s [log_dir [quorum_config]]\n", argv[0]);
+    exit(-1);
+  }
+  const char *dir = (argc >= 2) ? argv[1]:log_dir;
+  if(argc == 3) { // Executor and quorum counts of the logging server
+    cyclone_config_init(argv[2]);
+  }
+  const char *paths[MAX_EXECUTOR_THREADS];
+  for(int i=0;i<executor_threads;i++) {
+    char *log_path = (char *)malloc(strlen(dir) + 20);
+    sprintf(log_path, "%s/flash_log%d", dir, i);
+    paths[i] = log_path;
+  }
+  opendb();
+  unsigned long applied;
+  if(use_shared_flashlog) {
+    char *shared_path = (char *)malloc(strlen(dir) + 20);
+    sprintf(shared_path, "%s/flash_log_shared", dir);
+    applied = shared_flash_log_replay(shared_path, &rpc_callbacks);
+    free(shared_path);
+  }
+  else {
+    applied = flash_log_replay(paths, &rpc_callbacks);
+  }
+  rocksdb::Status s = db->Flush(rocksdb::FlushOptions());
+  if (!s.ok()){
+    BOOST_LOG_TRIVIAL(fatal) << s.ToString();
+    exit(-1);
+  }
+  BOOST_LOG_TRIVIAL(info) << "Replayed " << applied << " requests";
+  delete db;
+  for(int i=0;i<executor_threads;i++) {
+    free((void *)paths[i]);
+  }
+  return 0;
+}
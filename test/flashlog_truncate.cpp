@@ -0,0 +1,64 @@
+// Append several segments worth of records while truncating behind the
+// checkpoint, and check truncated segments are recycled: the number of
+// log files on disk stays bounded however long the log gets
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<glob.h>
+#include<string>
+#include<libcyclone.hpp>
+#include "../core/logging.hpp"
+#include "../core/clock.hpp"
+
+static int count_log_files(const char *path)
+{
+  glob_t files;
+  std::string pattern = std::string(path) + ".*";
+  int count = 0;
+  if(glob(pattern.c_str(), 0, NULL, &files) == 0) {
+    count = files.gl_pathc;
+  }
+  globfree(&files);
+  return count;
+}
+
+int main(int argc, char *argv[])
+{
+  if(argc != 3) {
+    printf("Usage: %s log_path segments\n", argv[0]);
+    exit(-1);
+  }
+  int segments = atoi(argv[2]);
+  // Two records to a page, each starting on a 4KB block
+  int size = flashlog_pagesize/2 - 8192;
+  unsigned long per_segment = 2*(flashlog_segsize/flashlog_pagesize);
+  char *data = (char *)malloc(size);
+  memset(data, 0xab, size);
+  // Current segment, the one sealed before it, one being recycled and
+  // the spares
+  int bound = flashlog_spare_segments + 3;
+  int most = 0;
+  void *log = create_flash_log(argv[1]);
+  unsigned long mark = rtc_clock::current_time();
+  for(unsigned long i=0;i<segments*per_segment;i++) {
+    int checkpoint = log_append(log, data, size, (int)i);
+    flash_log_truncate(log, checkpoint + 1);
+    if((i % per_segment) == per_segment - 1) {
+      int files = count_log_files(argv[1]);
+      if(files > most) {
+	most = files;
+      }
+      BOOST_LOG_TRIVIAL(info) << "Segment " << (i/per_segment)
+			      << " files " << files;
+      if(files > bound) {
+	BOOST_LOG_TRIVIAL(fatal) << "FAILED " << files
+				 << " log files, segments are not recycled";
+	exit(-1);
+      }
+    }
+  }
+  BOOST_LOG_TRIVIAL(info) << "PASSED " << segments << " segments in "
+			  << (rtc_clock::current_time() - mark)/1000000
+			  << " s with at most " << most << " files";
+  return 0;
+}
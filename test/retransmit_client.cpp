@@ -0,0 +1,130 @@
+// Check that a call retransmitted while it executes runs once, against
+// retransmit_server. The async ops are then pipelined as deep as the
+// credit window (dispatch.client_window) lets them.
+// Uses client ids client_id and client_id + 1, one per interface.
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<libcyclone.hpp>
+#include "../core/logging.hpp"
+#include "../core/clock.hpp"
+
+// Each op must bump the server's count for the client by exactly one
+static void check(int me, unsigned long *last, void *resp, int sz)
+{
+  if(sz != sizeof(unsigned long)) {
+    BOOST_LOG_TRIVIAL(fatal) << "Invalid response";
+    exit(-1);
+  }
+  unsigned long count = *(unsigned long *)resp;
+  if(*last != 0 && count != *last + 1) {
+    BOOST_LOG_TRIVIAL(fatal) << "FAILED client " << me
+			     << " op executed " << (count - *last)
+			     << " times";
+    exit(-1);
+  }
+  *last = count;
+}
+
+int main(int argc, const char *argv[])
+{
+  if(argc != 7) {
+    printf("Usage: %s client_id mc cluster_config quorum_config server_ports ops\n", argv[0]);
+    exit(-1);
+  }
+  int me  = atoi(argv[1]);
+  int ops = atoi(argv[6]);
+  cyclone_network_init(argv[3], 1, atoi(argv[2]), 3);
+  void *sync_handle = cyclone_client_init(me,
+					  atoi(argv[2]),
+					  1,
+					  argv[3],
+					  atoi(argv[5]),
+					  argv[4]);
+  void *async_handle = cyclone_client_init(me + 1,
+					   atoi(argv[2]),
+					   2,
+					   argv[3],
+					   atoi(argv[5]),
+					   argv[4]);
+  unsigned long last = 0;
+  unsigned long mark = rtc_clock::current_time();
+  for(int i=0;i<ops;i++) {
+    void *resp;
+    int sz = make_rpc(sync_handle,
+		      &me,
+		      sizeof(int),
+		      &resp,
+		      core_mask_single(0),
+		      0);
+    check(me, &last, resp, sz);
+  }
+  BOOST_LOG_TRIVIAL(info) << "make_rpc PASSED "
+			  << ops << " ops in "
+			  << (rtc_clock::current_time() - mark) << " us";
+  int async_me = me + 1;
+  rpc_completion_t completion;
+  last = 0;
+  mark = rtc_clock::current_time();
+  for(int i=0;i<ops;i++) {
+    if(make_rpc_async(async_handle,
+		      &async_me,
+		      sizeof(int),
+		      core_mask_single(0),
+		      0,
+		      NULL) != 0) {
+      BOOST_LOG_TRIVIAL(fatal) << "No credit for one async op";
+      exit(-1);
+    }
+    while(cyclone_poll(async_handle, &completion, 1) == 0);
+    check(async_me, &last, completion.response, completion.size);
+  }
+  BOOST_LOG_TRIVIAL(info) << "make_rpc_async PASSED "
+			  << ops << " ops in "
+			  << (rtc_clock::current_time() - mark) << " us";
+  // Keep the window full, completions can come back out of order so
+  // only the total is checked: one more op must find exactly ops more
+  int window = cyclone_client_credits(async_handle);
+  unsigned long base = last;
+  int sent = 0, done = 0;
+  mark = rtc_clock::current_time();
+  while(done < ops) {
+    while(sent < ops && make_rpc_async(async_handle,
+				       &async_me,
+				       sizeof(int),
+				       core_mask_single(0),
+				       0,
+				       NULL) == 0) {
+      sent++;
+    }
+    int got = cyclone_poll(async_handle, &completion, 1);
+    if(got == 0) {
+      continue;
+    }
+    unsigned long count = *(unsigned long *)completion.response;
+    if(completion.size != sizeof(unsigned long) ||
+       count <= base || count > base + ops) {
+      BOOST_LOG_TRIVIAL(fatal) << "FAILED window " << window
+			       << " count " << count << " outside ("
+			       << base << "," << (base + ops) << "]";
+      exit(-1);
+    }
+    done++;
+  }
+  last = base + ops;
+  if(make_rpc_async(async_handle,
+		    &async_me,
+		    sizeof(int),
+		    core_mask_single(0),
+		    0,
+		    NULL) != 0) {
+    BOOST_LOG_TRIVIAL(fatal) << "No credit for one async op";
+    exit(-1);
+  }
+  while(cyclone_poll(async_handle, &completion, 1) == 0);
+  check(async_me, &last, completion.response, completion.size);
+  BOOST_LOG_TRIVIAL(info) << "make_rpc_async window " << window
+			  << " PASSED " << ops << " ops in "
+			  << (rtc_clock::current_time() - mark) << " us";
+  return 0;
+}
@@ -0,0 +1,71 @@
+// Counts the ops executed for each client and holds every op on its
+// executor for longer than a client RTO, so each call is retransmitted
+// while it executes. Pairs with retransmit_client.
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<libcyclone.hpp>
+#include "../core/logging.hpp"
+#include "../core/clock.hpp"
+
+// Above any RTO the clients learn from probes, below failover
+static const unsigned long exec_usecs = 2*rto_initial_usec;
+
+static int clients;
+static unsigned long *executed;
+
+void callback(const unsigned char *data,
+	      const int len,
+	      rpc_cookie_t *cookie)
+{
+  int client = -1;
+  if(len == sizeof(int)) {
+    client = *(const int *)data;
+  }
+  if(client < 0 || client >= clients) {
+    BOOST_LOG_TRIVIAL(warning) << "Op from unknown client";
+    rpc_reply_buffer(cookie, 0);
+    return;
+  }
+  unsigned long until = rtc_clock::current_time() + exec_usecs;
+  while(rtc_clock::current_time() < until);
+  unsigned long count = __sync_add_and_fetch(&executed[client], 1);
+  rpc_reply_buffer(cookie, sizeof(unsigned long));
+  memcpy(cookie->ret_value, &count, sizeof(unsigned long));
+}
+
+int wal_callback(const unsigned char *data,
+		  const int len,
+		  rpc_cookie_t *cookie)
+{
+  return cookie->log_idx;
+}
+
+rpc_callbacks_t rpc_callbacks =  {
+  callback,
+  NULL,
+  wal_callback
+};
+
+int main(int argc, char *argv[])
+{
+  if(argc != 7) {
+    printf("Usage1: %s replica_id replica_mc clients cluster_config quorum_config ports\n", argv[0]);
+    exit(-1);
+  }
+  cyclone_config_init(argv[5]);
+  clients  = atoi(argv[3]);
+  executed = (unsigned long *)malloc(clients*sizeof(unsigned long));
+  memset(executed, 0, clients*sizeof(unsigned long));
+  int server_id = atoi(argv[1]);
+  cyclone_network_init(argv[4],
+		       atoi(argv[6]),
+		       atoi(argv[2]),
+		       atoi(argv[6]) + num_queues*num_quorums + executor_threads);
+  dispatcher_start(argv[4],
+		   argv[5],
+		   &rpc_callbacks,
+		   server_id,
+		   atoi(argv[2]),
+		   atoi(argv[3]));
+}
@@ -18,5 +18,11 @@ const char *data_dir = "/dev/shm/checkpoint";
 const char *log_dir  = "/mnt/ssd/logs";
 const unsigned long rocks_keys = 100000000;
 const int use_flashlog   = 1;
+const int flashlog_truncate_secs = 10; // Flush rocksdb, recycle log
+const int use_shared_flashlog = 0; // One log for all executors
+const int use_flashlog_offload = 0; // Log from a dedicated lcore
 const int use_rocksdbwal = 0;
+const int use_batch_callback = 0; // WriteBatch/MultiGet per executor pass
+const int use_speculation = 0; // Execute before commit, puts held until then
+const int use_ro_anycore = 0; // Gets flagged RPC_FLAG_ANYCORE run on any core
 #endif
@@ -98,6 +98,10 @@ int driver(void *arg)
     keys = atol(keys_env);
   }
   BOOST_LOG_TRIVIAL(info) << "KEYS = " << keys;
+  int ro_flags = RPC_FLAG_RO;
+  if(getenv("KV_ANYCORE") != NULL) { // Reads may run on any executor
+    ro_flags |= RPC_FLAG_ANYCORE;
+  }
 
   total_latency = 0;
   tx_block_cnt  = 0;
@@ -112,7 +116,7 @@ int driver(void *arg)
       kv->op    = OP_PUT;
     }
     else {
-      rpc_flags = RPC_FLAG_RO;
+      rpc_flags = ro_flags;
       kv->op    = OP_GET;
     }
     kv->key   = rand() % keys;
@@ -121,7 +125,7 @@ int driver(void *arg)
 		  buffer,
 		  sizeof(rock_kv_t),
 		  (void **)&resp,
-		  1UL << my_core,
+		  core_mask_single(my_core),
 		  rpc_flags);
     tx_block_cnt++;
     
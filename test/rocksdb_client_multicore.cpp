@@ -61,16 +61,16 @@ typedef struct driver_args_st {
   }
 } driver_args_t;
 
-int gen_multi(char * buffer, int keys, unsigned long max_key, unsigned long *core_mask)
+int gen_multi(char * buffer, int keys, unsigned long max_key, core_mask_t *core_mask)
 {
   rock_kv_t *head = (rock_kv_t *)buffer;
   int size = sizeof(rock_kv_t);
   head->key = rand() % max_key;
-  (*core_mask) |= (1UL << (head->key % executor_threads));
+  core_mask_set(core_mask, head->key % executor_threads);
   rock_kv_pair_t *tail = (rock_kv_pair_t *)(buffer + sizeof(rock_kv_t));
   for(int i=1;i<keys;i++,tail++) {
     tail->key = rand() % max_key;
-    (*core_mask) |= (1UL << (tail->key % executor_threads));
+    core_mask_set(core_mask, tail->key % executor_threads);
     size += sizeof(rock_kv_pair_t);
   }
   return size;
@@ -120,6 +120,10 @@ int driver(void *arg)
     active = atol(active_env);
   }
   BOOST_LOG_TRIVIAL(info) << "ACTIVE = " << active;
+  int put_flags = 0;
+  if(getenv("KV_SINGLE_EXEC") != NULL) { // Multi puts run on one executor
+    put_flags |= RPC_FLAG_SINGLE_EXEC;
+  }
 
 
   total_latency = 0;
@@ -131,9 +135,9 @@ int driver(void *arg)
   while(true) {
     double coin = ((double)rand())/RAND_MAX;
     if(coin > frac_read) {
-      rpc_flags = 0;
+      rpc_flags = put_flags;
       kv->op    = OP_PUT;
-      unsigned long cmask = 0;
+      core_mask_t cmask = core_mask_none();
       //int random_core = rand() % executor_threads;
       int req_sz = gen_multi(buffer, active, keys, &cmask);
       sz = make_rpc(handles[0],
@@ -152,7 +156,7 @@ int driver(void *arg)
 		  buffer,
 		  sizeof(rock_kv_t),
 		  (void **)&resp,
-		  1UL << my_core,
+		  core_mask_single(my_core),
 		  rpc_flags);
     
     }
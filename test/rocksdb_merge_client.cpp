@@ -123,7 +123,7 @@ int driver(void *arg)
 		  buffer,
 		  sizeof(rock_kv_t),
 		  (void **)&resp,
-		  1UL << my_core,
+		  core_mask_single(my_core),
 		  rpc_flags);
     tx_block_cnt++;
     
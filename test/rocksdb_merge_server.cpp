@@ -52,29 +52,30 @@
 static unsigned long *marks;
 static unsigned long *completions;
 rocksdb::DB* db = NULL;
-static void *logs[executor_threads];
+static void *logs[MAX_EXECUTOR_THREADS];
 
 typedef struct batch_barrier_st {
-  volatile unsigned long batch_barrier[2];
+  volatile unsigned long batch_barrier[2][CORE_MASK_WORDS];
   volatile int batch_barrier_sense;
 } batch_barrier_t;
 
-static batch_barrier_t barriers[executor_threads];
+static batch_barrier_t barriers[MAX_EXECUTOR_THREADS];
 
 static void barrier(batch_barrier_t *barrier,
 		    int thread_id, 
-		    unsigned long mask, 
+		    core_mask_t mask, 
 		    bool leader)
 {
   int sense = barrier->batch_barrier_sense;
-  __sync_fetch_and_or(&barrier->batch_barrier[sense], 1UL << thread_id);
+  core_mask_atomic_set(barrier->batch_barrier[sense], thread_id);
   if(leader) {
-    while(barrier->batch_barrier[sense] != mask);
+    while(!core_mask_atomic_equal(barrier->batch_barrier[sense], mask));
     barrier->batch_barrier_sense  = 1 - barrier->batch_barrier_sense;
-    barrier->batch_barrier[sense] = 0;
+    core_mask_atomic_clear(barrier->batch_barrier[sense]);
   }
   else {
-    while(barrier->batch_barrier[sense] != 0);
+    while(!core_mask_atomic_equal(barrier->batch_barrier[sense],
+				  core_mask_none()));
   }
 }
 
@@ -112,8 +113,7 @@ void callback(const unsigned char *data,
 	      const int len,
 	      rpc_cookie_t *cookie)
 {
-  cookie->ret_value  = malloc(len);
-  cookie->ret_size   = len;
+  rpc_reply_buffer(cookie, len);
   rock_kv_t *rock = (rock_kv_t *)data;
   if(rock->op == OP_PUT) {
     rocksdb::WriteOptions write_options;
@@ -137,7 +137,7 @@ void callback(const unsigned char *data,
       }
     }
     else {
-      int leader = __builtin_ffsl(cookie->core_mask) - 1;
+      int leader = core_mask_first(cookie->core_mask);
       if(leader == cookie->core_id) { // Multi put
 	rocksdb::WriteBatch batch;
 	int bytes  = len;
@@ -165,7 +165,9 @@ void callback(const unsigned char *data,
 	  BOOST_LOG_TRIVIAL(fatal) << s.ToString();
 	  exit(-1);
 	}
-	barrier(&barriers[leader], cookie->core_id, cookie->core_mask, true);
+	if(!cookie->single_exec) {
+	  barrier(&barriers[leader], cookie->core_id, cookie->core_mask, true);
+	}
       }
       else {
 	barrier(&barriers[leader], cookie->core_id, cookie->core_mask, false);
@@ -235,14 +237,9 @@ int wal_callback(const unsigned char *data,
   }
 }
 
-void gc(rpc_cookie_t *cookie)
-{
-  free(cookie->ret_value);
-}
-
 rpc_callbacks_t rpc_callbacks =  {
   callback,
-  gc,
+  NULL,
   wal_callback
 };
 
@@ -275,13 +272,14 @@ int main(int argc, char *argv[])
     printf("Usage1: %s replica_id replica_mc clients cluster_config quorum_config ports\n", argv[0]);
     exit(-1);
   }
+  cyclone_config_init(argv[5]);
   marks       = (unsigned long *)malloc(executor_threads*sizeof(unsigned long));
   completions = (unsigned long *)malloc(executor_threads*sizeof(unsigned long));
   memset(marks, 0, executor_threads*sizeof(unsigned long));
   memset(completions, 0, executor_threads*sizeof(unsigned long));
   for(int i=0;i<executor_threads;i++) {
-    barriers[i].batch_barrier[0] = 0;
-    barriers[i].batch_barrier[1] = 0;
+    core_mask_atomic_clear(barriers[i].batch_barrier[0]);
+    core_mask_atomic_clear(barriers[i].batch_barrier[1]);
     barriers[i].batch_barrier_sense = 0;
   }
   int server_id = atoi(argv[1]);
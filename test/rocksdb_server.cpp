@@ -45,43 +45,201 @@
 #include <rocksdb/options.h>
 #include "rocksdb.hpp"
 #include <rocksdb/write_batch.h>
+#include <vector>
+#include <deque>
+#include <boost/thread.hpp>
 
 // Rate measurement stuff
 static unsigned long *marks;
 static unsigned long *completions;
 rocksdb::DB* db = NULL;
-static void *logs[executor_threads];
+static void *logs[MAX_EXECUTOR_THREADS];
+static void *shared_log;
 
 typedef struct batch_barrier_st {
-  volatile unsigned long batch_barrier[2];
+  volatile unsigned long batch_barrier[2][CORE_MASK_WORDS];
   volatile int batch_barrier_sense;
 } batch_barrier_t;
 
-static batch_barrier_t barriers[executor_threads];
+static batch_barrier_t barriers[MAX_EXECUTOR_THREADS];
 
 static void barrier(batch_barrier_t *barrier,
 		    int thread_id, 
-		    unsigned long mask, 
+		    core_mask_t mask, 
 		    bool leader)
 {
   int sense = barrier->batch_barrier_sense;
-  __sync_fetch_and_or(&barrier->batch_barrier[sense], 1UL << thread_id);
+  core_mask_atomic_set(barrier->batch_barrier[sense], thread_id);
   if(leader) {
-    while(barrier->batch_barrier[sense] != mask);
+    while(!core_mask_atomic_equal(barrier->batch_barrier[sense], mask));
     barrier->batch_barrier_sense  = 1 - barrier->batch_barrier_sense;
-    barrier->batch_barrier[sense] = 0;
+    core_mask_atomic_clear(barrier->batch_barrier[sense]);
   }
   else {
-    while(barrier->batch_barrier[sense] != 0);
+    while(!core_mask_atomic_equal(barrier->batch_barrier[sense],
+				  core_mask_none()));
   }
 }
 
+static void put_batch(rocksdb::WriteBatch *batch)
+{
+  rocksdb::WriteOptions write_options;
+  if(use_rocksdbwal) {
+    write_options.sync       = true;
+    write_options.disableWAL = false;
+  }
+  else {
+    write_options.sync       = false;
+    write_options.disableWAL = true;
+  }
+  rocksdb::Status s = db->Write(write_options, batch);
+  if (!s.ok()){
+    BOOST_LOG_TRIVIAL(fatal) << s.ToString();
+    exit(-1);
+  }
+  batch->Clear();
+}
+
+static void get_batch(std::vector<rocksdb::Slice> &keys,
+		      std::vector<rpc_cookie_t *> &cookies)
+{
+  std::vector<std::string> values;
+  std::vector<rocksdb::Status> s = db->MultiGet(rocksdb::ReadOptions(),
+						keys,
+						&values);
+  for(unsigned int i=0;i<keys.size();i++) {
+    rock_kv_t *rock_back = (rock_kv_t *)cookies[i]->ret_value;
+    if(s[i].IsNotFound()) {
+      rock_back->key = ULONG_MAX;
+    }
+    else {
+      rock_back->key = *(const unsigned long *)keys[i].data();
+      memcpy(rock_back->value, values[i].c_str(), value_sz);
+    }
+  }
+  keys.clear();
+  cookies.clear();
+}
+
+// Speculative requests (executed before commit) keep their puts here
+// in log order until spec_commit writes them, gets look here first
+static std::deque<std::vector<rock_kv_pair_t> > spec_puts[MAX_EXECUTOR_THREADS];
+
+// Raft idx of the last op each executor applied to rocksdb, ops before
+// it on the same executor are applied too
+static volatile int applied_idx[MAX_EXECUTOR_THREADS];
+
+static void mark_applied(rpc_cookie_t *cookie)
+{
+  // Speculative puts still pending are not in rocksdb yet
+  if(spec_puts[cookie->core_id].empty()) {
+    applied_idx[cookie->core_id] = cookie->log_idx;
+  }
+}
+
+// Once rocksdb has flushed what executors applied, flash log records up
+// to there are not needed to recover and their segments are recycled
+static void log_truncator()
+{
+  int idx[MAX_EXECUTOR_THREADS];
+  while(true) {
+    sleep(flashlog_truncate_secs);
+    for(int i=0;i<executor_threads;i++) {
+      idx[i] = applied_idx[i];
+    }
+    rocksdb::FlushOptions flush_options;
+    flush_options.wait = true;
+    rocksdb::Status s = db->Flush(flush_options);
+    if(!s.ok()) {
+      BOOST_LOG_TRIVIAL(warning) << "Flush for log truncation failed: "
+				 << s.ToString();
+      continue;
+    }
+    for(int i=0;i<executor_threads;i++) {
+      if(idx[i] >= 0) {
+	flash_log_truncate(logs[i], idx[i] + 1);
+      }
+    }
+  }
+}
+
+static void spec_callback(const unsigned char *data,
+			  const int len,
+			  rpc_cookie_t *cookie)
+{
+  std::deque<std::vector<rock_kv_pair_t> > &pending = 
+    spec_puts[cookie->core_id];
+  rock_kv_t *rock = (rock_kv_t *)data;
+  pending.push_back(std::vector<rock_kv_pair_t>());
+  if(rock->op == OP_PUT) {
+    std::vector<rock_kv_pair_t> &puts = pending.back();
+    rock_kv_pair_t kv;
+    kv.key = rock->key;
+    memcpy(kv.value, rock->value, value_sz);
+    puts.push_back(kv);
+    const rock_kv_pair_t *pairs = 
+      (const rock_kv_pair_t *)(data + sizeof(rock_kv_t));
+    int cnt = (len - sizeof(rock_kv_t))/sizeof(rock_kv_pair_t);
+    puts.insert(puts.end(), pairs, pairs + cnt);
+    memcpy(cookie->ret_value, data, len);
+    return;
+  }
+  rock_kv_t *rock_back = (rock_kv_t *)cookie->ret_value;
+  for(int i=pending.size()-1;i>=0;i--) {
+    for(int j=pending[i].size()-1;j>=0;j--) {
+      if(pending[i][j].key == rock->key) {
+	rock_back->key = rock->key;
+	memcpy(rock_back->value, pending[i][j].value, value_sz);
+	return;
+      }
+    }
+  }
+  rocksdb::Slice key((const char *)&rock->key, 8);
+  std::string value;
+  rocksdb::Status s = db->Get(rocksdb::ReadOptions(),
+			      key,
+			      &value);
+  if(s.IsNotFound()) {
+    rock_back->key = ULONG_MAX;
+  }
+  else {
+    rock_back->key = rock->key;
+    memcpy(rock_back->value, value.c_str(), value_sz);
+  }
+}
+
+void spec_commit(rpc_cookie_t *cookie)
+{
+  std::deque<std::vector<rock_kv_pair_t> > &pending = 
+    spec_puts[cookie->core_id];
+  if(pending.front().size() > 0) {
+    rocksdb::WriteBatch batch;
+    for(unsigned int i=0;i<pending.front().size();i++) {
+      rock_kv_pair_t *kv = &pending.front()[i];
+      rocksdb::Slice key((const char *)&kv->key, 8);
+      rocksdb::Slice value((const char *)&kv->value[0], value_sz);
+      batch.Put(key, value);
+    }
+    put_batch(&batch);
+  }
+  pending.pop_front();
+  mark_applied(cookie);
+}
+
+void spec_abort(rpc_cookie_t *cookie)
+{
+  spec_puts[cookie->core_id].pop_back();
+}
+
 void callback(const unsigned char *data,
 	      const int len,
 	      rpc_cookie_t *cookie)
 {
-  cookie->ret_value  = malloc(len);
-  cookie->ret_size   = len;
+  rpc_reply_buffer(cookie, len);
+  if(cookie->speculative) {
+    spec_callback(data, len, cookie);
+    return;
+  }
   rock_kv_t *rock = (rock_kv_t *)data;
   if(rock->op == OP_PUT) {
     rocksdb::WriteOptions write_options;
@@ -105,7 +263,7 @@ void callback(const unsigned char *data,
       }
     }
     else {
-      int leader = __builtin_ffsl(cookie->core_mask) - 1;
+      int leader = core_mask_first(cookie->core_mask);
       if(leader == cookie->core_id) { // Multi put
 	rocksdb::WriteBatch batch;
 	int bytes  = len;
@@ -133,7 +291,9 @@ void callback(const unsigned char *data,
 	  BOOST_LOG_TRIVIAL(fatal) << s.ToString();
 	  exit(-1);
 	}
-	barrier(&barriers[leader], cookie->core_id, cookie->core_mask, true);
+	if(!cookie->single_exec) {
+	  barrier(&barriers[leader], cookie->core_id, cookie->core_mask, true);
+	}
       }
       else {
 	barrier(&barriers[leader], cookie->core_id, cookie->core_mask, false);
@@ -156,6 +316,7 @@ void callback(const unsigned char *data,
       memcpy(rock_back->value, value.c_str(), value_sz);
     }
   }
+  mark_applied(cookie);
   /*
   if((++completions[cookie->core_id]) >= 1000000) {
     BOOST_LOG_TRIVIAL(info) << "Completion rate = "
@@ -167,11 +328,69 @@ void callback(const unsigned char *data,
   */
 }
 
+// Puts go into one WriteBatch and gets into one MultiGet, flushing
+// one before the other whenever the op changes to keep log order
+void batch_callback(const unsigned char **data,
+		    const int *len,
+		    rpc_cookie_t *cookies,
+		    int count)
+{
+  rocksdb::WriteBatch batch;
+  std::vector<rocksdb::Slice> keys;
+  std::vector<rpc_cookie_t *> get_cookies;
+  for(int i=0;i<count;i++) {
+    rpc_reply_buffer(&cookies[i], len[i]);
+    rock_kv_t *rock = (rock_kv_t *)data[i];
+    if(rock->op == OP_PUT) {
+      if(keys.size() > 0) {
+	get_batch(keys, get_cookies);
+      }
+      rocksdb::Slice key((const char *)&rock->key, 8);
+      rocksdb::Slice value((const char *)&rock->value[0], value_sz);
+      batch.Put(key, value);
+      const unsigned char *buffer = data[i] + sizeof(rock_kv_t);
+      int bytes = len[i] - sizeof(rock_kv_t);
+      while(bytes > 0) { // Multi put
+	rock_kv_pair_t *kv = (rock_kv_pair_t *)buffer;
+	rocksdb::Slice key((const char *)&kv->key, 8);
+	rocksdb::Slice value((const char *)&kv->value[0], value_sz);
+	batch.Put(key, value);
+	buffer = buffer + sizeof(rock_kv_pair_t);
+	bytes -= sizeof(rock_kv_pair_t);
+      }
+      memcpy(cookies[i].ret_value, data[i], len[i]);
+    }
+    else {
+      if(batch.Count() > 0) {
+	put_batch(&batch);
+      }
+      keys.push_back(rocksdb::Slice((const char *)&rock->key, 8));
+      get_cookies.push_back(&cookies[i]);
+    }
+  }
+  if(batch.Count() > 0) {
+    put_batch(&batch);
+  }
+  if(keys.size() > 0) {
+    get_batch(keys, get_cookies);
+  }
+  if(count > 0) {
+    mark_applied(&cookies[count - 1]);
+  }
+}
+
 int wal_callback(const unsigned char *data,
 		 const int len,
 		 rpc_cookie_t *cookie)
 {
-  if(use_flashlog) {
+  if(use_flashlog && use_shared_flashlog) {
+    return shared_log_append(shared_log,
+			     cookie->core_id,
+			     (const char *)data,
+			     len,
+			     cookie->log_idx);
+  }
+  else if(use_flashlog) {
     int idx = log_append(logs[cookie->core_id],
 			 (const char *)data,
 			 len, 
@@ -183,15 +402,24 @@ int wal_callback(const unsigned char *data,
   }
 }
 
-void gc(rpc_cookie_t *cookie)
+int wal_poll(rpc_cookie_t *cookie)
 {
-  free(cookie->ret_value);
+  if(use_shared_flashlog) {
+    return shared_log_poll(shared_log, cookie->core_id);
+  }
+  else {
+    return log_poll(logs[cookie->core_id]);
+  }
 }
 
 rpc_callbacks_t rpc_callbacks =  {
   callback,
-  gc,
-  wal_callback
+  NULL,
+  wal_callback,
+  use_flashlog ? wal_poll:NULL,
+  use_batch_callback ? batch_callback:NULL,
+  use_speculation ? spec_commit:NULL,
+  use_speculation ? spec_abort:NULL
 };
 
 
@@ -222,13 +450,14 @@ int main(int argc, char *argv[])
     printf("Usage1: %s replica_id replica_mc clients cluster_config quorum_config ports\n", argv[0]);
     exit(-1);
   }
+  cyclone_config_init(argv[5]);
   marks       = (unsigned long *)malloc(executor_threads*sizeof(unsigned long));
   completions = (unsigned long *)malloc(executor_threads*sizeof(unsigned long));
   memset(marks, 0, executor_threads*sizeof(unsigned long));
   memset(completions, 0, executor_threads*sizeof(unsigned long));
   for(int i=0;i<executor_threads;i++) {
-    barriers[i].batch_barrier[0] = 0;
-    barriers[i].batch_barrier[1] = 0;
+    core_mask_atomic_clear(barriers[i].batch_barrier[0]);
+    core_mask_atomic_clear(barriers[i].batch_barrier[1]);
     barriers[i].batch_barrier_sense = 0;
   }
   int server_id = atoi(argv[1]);
@@ -239,12 +468,31 @@ int main(int argc, char *argv[])
   
 
   char log_path[50];
-  for(int i=0;i<executor_threads;i++) {
-    sprintf(log_path, "%s/flash_log%d", log_dir, i);
-    logs[i] = create_flash_log(log_path);
+  if(use_shared_flashlog) {
+    sprintf(log_path, "%s/flash_log_shared", log_dir);
+    shared_log = create_shared_flash_log(log_path, executor_threads);
+  }
+  else {
+    for(int i=0;i<executor_threads;i++) {
+      sprintf(log_path, "%s/flash_log%d", log_dir, i);
+      logs[i] = create_flash_log(log_path);
+    }
+    if(use_flashlog && use_flashlog_offload) {
+      dispatcher_flashlog_offload(logs);
+    }
   }
   
+  if(use_ro_anycore) {
+    dispatcher_ro_anycore();
+  }
+
   opendb();
+  if(use_flashlog && !use_shared_flashlog) {
+    for(int i=0;i<executor_threads;i++) {
+      applied_idx[i] = -1;
+    }
+    new boost::thread(log_truncator);
+  }
   
   
   dispatcher_start(argv[4], 
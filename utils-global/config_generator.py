@@ -119,6 +119,11 @@ for q in range(0, quorums):
     f.write('server_baseport=' + str(compute_server_baseport(q)) + '\n')
     f.write('filepath=' + str(filepath) + '\n')
     f.write('heapsize=' + str(heapsize) + '\n')
+    for key in ['executors', 'raft_quorums', 'q_bufs', 'rocksdb_threads',
+                'client_window', 'lcores', 'partitions', 'partition_map']:
+        if config.has_option('meta', key): # Else compiled in defaults
+            name = 'quorums' if key == 'raft_quorums' else key
+            f.write(name + '=' + config.get('meta', key) + '\n')
     f.close()
     for r in range(0, replicas):
         mc=replica_mc(q, r)